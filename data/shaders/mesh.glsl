@@ -11,14 +11,20 @@ varying   lowp    vec4 v_color;
 
 #ifdef VERTEX_SHADER
 
+#ifdef PROJ
 #includes "projections.glsl"
+#endif
 
 attribute highp   vec3 a_pos;
 attribute lowp    vec4 a_color;
 
 void main()
 {
+#ifdef PROJ
     gl_Position = proj(a_pos);
+#else
+    gl_Position = vec4(a_pos, 1.0);
+#endif
     v_color = a_color;
 }
 
@@ -50,6 +50,35 @@ static json_value *core_fn_progressbars(obj_t *obj, const attribute_t *attr,
     return ret;
 }
 
+// Debug statistics about the last rendered frame.
+static json_value *core_fn_render_stats(obj_t *obj, const attribute_t *attr,
+                                        const json_value *args)
+{
+    json_value *ret;
+    int nb_replayed = 0, nb_recorded = 0, nb_tested, nb_culled, nb_items = 0;
+    int nb_uploaded, nb_deferred;
+    double upload_time;
+
+    if (core->rend) {
+        render_get_lists_stats(core->rend, &nb_replayed, &nb_recorded);
+        nb_items = render_get_nb_items_flushed(core->rend);
+    }
+    painter_get_clip_stats(&nb_tested, &nb_culled);
+    texture_upload_get_stats(&nb_uploaded, &nb_deferred, &upload_time);
+    ret = json_object_new(0);
+    json_object_push(ret, "lists_replayed", json_integer_new(nb_replayed));
+    json_object_push(ret, "lists_recorded", json_integer_new(nb_recorded));
+    json_object_push(ret, "quads_tested", json_integer_new(nb_tested));
+    json_object_push(ret, "quads_culled_by_viewport_polygon",
+                     json_integer_new(nb_culled));
+    json_object_push(ret, "items_flushed", json_integer_new(nb_items));
+    json_object_push(ret, "textures_uploaded", json_integer_new(nb_uploaded));
+    json_object_push(ret, "textures_deferred", json_integer_new(nb_deferred));
+    json_object_push(ret, "textures_upload_time",
+                     json_double_new(upload_time));
+    return ret;
+}
+
 EMSCRIPTEN_KEEPALIVE
 obj_t *core_get_module(const char *id)
 {
@@ -93,18 +122,98 @@ static int modules_sort_cmp(void *a, void *b)
     return cmp(module_get_render_order(at), module_get_render_order(bt));
 }
 
-bool core_is_point_occulted(const double pos[3], bool at_inf,
-                            const observer_t *obs, const obj_t *ignore)
+/*
+ * Spheres that can hide other objects, as seen from the observer.  We
+ * collect them once per frame, and only keep the ones intersecting the
+ * viewport since we only use them to hide the labels.
+ */
+typedef struct {
+    const obj_t *obj;
+    double      cap[4]; // Cap covering the sphere.
+    double      dist2;  // Square distance to the observer (AU^2).
+} occulter_t;
+
+static struct {
+    bool        valid;
+    uint64_t    obs_hash;
+    double      viewport_cap[4]; // ICRF bounding cap of the viewport.
+    int         nb;
+    int         allocated;
+    occulter_t  *items;
+} g_occulters = {.viewport_cap = {1, 0, 0, -1}};
+
+static void add_occulter(void *user, const obj_t *obj, const double pos[3],
+                         double radius)
+{
+    occulter_t *occ;
+    double cap[4], dist2 = vec3_norm2(pos);
+
+    vec3_normalize(pos, cap);
+    // If we are inside the sphere, it hides half of the sky.
+    cap[3] = radius * radius < dist2 ? sqrt(1.0 - radius * radius / dist2)
+                                     : 0.0;
+    if (!cap_intersects_cap(g_occulters.viewport_cap, cap)) return;
+
+    if (g_occulters.nb >= g_occulters.allocated) {
+        g_occulters.allocated = g_occulters.allocated * 2 ?: 16;
+        g_occulters.items = realloc(g_occulters.items,
+                g_occulters.allocated * sizeof(*g_occulters.items));
+    }
+    occ = &g_occulters.items[g_occulters.nb++];
+    occ->obj = obj;
+    vec4_copy(cap, occ->cap);
+    occ->dist2 = dist2;
+}
+
+static void update_occulters(const observer_t *obs)
 {
     obj_t *module;
+    if (g_occulters.valid && g_occulters.obs_hash == obs->hash) return;
+    g_occulters.nb = 0;
     DL_FOREACH(core->obj.children, module) {
-        if (!module->klass->is_point_occulted) continue;
-        if (module->klass->is_point_occulted(module, pos, at_inf, obs, ignore))
-            return true;
+        if (!module->klass->get_occulters) continue;
+        module->klass->get_occulters(module, obs, NULL, add_occulter);
+    }
+    g_occulters.valid = true;
+    g_occulters.obs_hash = obs->hash;
+}
+
+static bool is_point_occulted(const double pos[3], bool at_inf,
+                              const obj_t *ignore)
+{
+    int i;
+    const occulter_t *occ;
+    double dir[3], dist2 = vec3_norm2(pos);
+
+    vec3_normalize(pos, dir);
+    for (i = 0; i < g_occulters.nb; i++) {
+        occ = &g_occulters.items[i];
+        if (occ->obj == ignore) continue;
+        if (!at_inf && dist2 < occ->dist2) continue;
+        if (vec3_dot(dir, occ->cap) > occ->cap[3]) return true;
     }
     return false;
 }
 
+bool core_is_point_occulted(const double pos[3], bool at_inf,
+                            const observer_t *obs, const obj_t *ignore)
+{
+    update_occulters(obs);
+    return is_point_occulted(pos, at_inf, ignore);
+}
+
+void core_are_points_occulted(int nb, const double (*pos)[3],
+                              const bool *at_inf,
+                              const obj_t *const *ignore,
+                              const observer_t *obs, bool *out)
+{
+    int i;
+    update_occulters(obs);
+    for (i = 0; i < nb; i++)
+        out[i] = g_occulters.nb && is_point_occulted(pos[i], at_inf[i],
+                                                     ignore[i]);
+}
+
 /*
  * Function: core_get_proj
  * Get the core current view projection
@@ -282,6 +391,121 @@ static void update_refraction(double dt, bool on)
     obs->pressure *= core->refraction.value;
 }
 
+enum {
+    INPUT_EVENT_MOUSE = 1,
+    INPUT_EVENT_PINCH,
+    INPUT_EVENT_ZOOM,
+};
+
+static void on_mouse(int id, int state, double x, double y, int buttons)
+{
+    obj_t *module;
+    int r;
+    DL_FOREACH(core->obj.children, module) {
+        if (!module->klass->on_mouse) continue;
+        r = module->klass->on_mouse(module, id, state, x, y, buttons);
+        if (r == 0) return;
+    }
+}
+
+static void on_pinch(int state, double x, double y, double scale,
+                     int points_count)
+{
+    obj_t *module;
+    int r;
+    DL_FOREACH(core->obj.children, module) {
+        if (!module->klass->on_pinch) continue;
+        r = module->klass->on_pinch(module, state, x, y, scale, points_count);
+        if (r == 0) return;
+    }
+}
+
+static void on_zoom(double k, double x, double y)
+{
+    obj_t *module;
+    DL_FOREACH(core->obj.children, module) {
+        if (module->klass->on_zoom) {
+            if (module->klass->on_zoom(module, k, x, y) == 0)
+                return;
+        };
+    }
+}
+
+// Send all the queued input events to the modules.
+static void process_events(void)
+{
+    int i;
+    input_event_t *e;
+
+    for (i = 0; i < core->inputs.nb_events; i++) {
+        e = &core->inputs.events[i];
+        switch (e->type) {
+        case INPUT_EVENT_MOUSE:
+            on_mouse(e->id, e->state, e->pos[0], e->pos[1], e->buttons);
+            break;
+        case INPUT_EVENT_PINCH:
+            on_pinch(e->state, e->pos[0], e->pos[1], e->k, e->buttons);
+            break;
+        case INPUT_EVENT_ZOOM:
+            on_zoom(e->k, e->pos[0], e->pos[1]);
+            break;
+        }
+    }
+    core->inputs.nb_events = 0;
+}
+
+/*
+ * Return a queued event that a new event can be merged into, or NULL.
+ *
+ * Touch moves can be merged with the last move of the same touch, as
+ * long as only moves have been queued since.  Zoom and pinch updates can
+ * be merged with the last event if it is of the same kind.
+ */
+static input_event_t *get_mergeable_event(
+        int type, int id, int state, int buttons)
+{
+    int i;
+    input_event_t *e;
+
+    if (!core->inputs.nb_events) return NULL;
+    e = &core->inputs.events[core->inputs.nb_events - 1];
+    if (type == INPUT_EVENT_ZOOM)
+        return e->type == INPUT_EVENT_ZOOM ? e : NULL;
+    if (type == INPUT_EVENT_PINCH) {
+        return (state == 1 && e->type == INPUT_EVENT_PINCH &&
+                e->state == 1 && e->buttons == buttons) ? e : NULL;
+    }
+    if (state != -1) return NULL;
+    for (i = core->inputs.nb_events - 1; i >= 0; i--) {
+        e = &core->inputs.events[i];
+        if (e->type != INPUT_EVENT_MOUSE || e->state != -1) return NULL;
+        if (e->id == id) return e->buttons == buttons ? e : NULL;
+    }
+    return NULL;
+}
+
+static void queue_event(int type, int id, int state, double x, double y,
+                        double k, int buttons)
+{
+    input_event_t *e;
+
+    e = get_mergeable_event(type, id, state, buttons);
+    if (e) {
+        vec2_set(e->pos, x, y);
+        e->k = (type == INPUT_EVENT_ZOOM) ? e->k * k : k;
+        return;
+    }
+    if (core->inputs.nb_events >= ARRAY_SIZE(core->inputs.events))
+        process_events();
+    e = &core->inputs.events[core->inputs.nb_events++];
+    e->type = type;
+    e->id = id;
+    e->state = state;
+    vec2_set(e->pos, x, y);
+    e->k = k;
+    e->buttons = buttons;
+}
+
 EMSCRIPTEN_KEEPALIVE
 int core_update(void)
 {
@@ -295,6 +519,7 @@ int core_update(void)
     dt = now - core->clock;
     dt = fmax(dt, 0.001); // Prevent bug in case the clock goes backward.
     core->clock = now;
+    process_events();
 
     atm = core_get_module("atmosphere");
     assert(atm);
@@ -523,6 +748,7 @@ int core_render(double win_w, double win_h, double pixel_scale)
     obj_t *module;
     projection_t proj;
     double max_vmag, hints_vmag;
+    int nb_uploaded, nb_deferred;
 
     // Used to make sure some values are not touched during render.
     struct {
@@ -549,6 +775,7 @@ int core_render(double win_w, double win_h, double pixel_scale)
     if (!core->rend)
         core->rend = render_create();
     labels_reset();
+    texture_upload_begin_frame();
 
     painter_t painter = {
         .rend = core->rend,
@@ -569,6 +796,11 @@ int core_render(double win_w, double win_h, double pixel_scale)
     painter_update_clip_info(&painter);
     paint_prepare(&painter, win_w, win_h, pixel_scale);
 
+    // Collect the occulters again at the first query of this frame.
+    g_occulters.valid = false;
+    vec4_copy(painter.clip_info[FRAME_ICRF].bounding_cap,
+              g_occulters.viewport_cap);
+
     DL_FOREACH(core->obj.children, module) {
         obj_render(module, &painter);
     }
@@ -586,6 +818,13 @@ int core_render(double win_w, double win_h, double pixel_scale)
     // Flush all rendering pipeline
     paint_finish(&painter);
 
+    // Show the textures whose upload has been postponed to the next frames.
+    texture_upload_get_stats(&nb_uploaded, &nb_deferred, NULL);
+    if (nb_deferred) {
+        progressbar_report("textures_upload", "Textures", nb_uploaded,
+                           nb_uploaded + nb_deferred, -1);
+    }
+
     assert(bck.obs.tt == core->observer->tt);
     assert(bck.obs.yaw == core->observer->yaw);
     assert(bck.obs.pitch == core->observer->pitch);
@@ -603,26 +842,14 @@ int core_render(double win_w, double win_h, double pixel_scale)
 EMSCRIPTEN_KEEPALIVE
 void core_on_mouse(int id, int state, double x, double y, int buttons)
 {
-    obj_t *module;
-    int r;
-    DL_FOREACH(core->obj.children, module) {
-        if (!module->klass->on_mouse) continue;
-        r = module->klass->on_mouse(module, id, state, x, y, buttons);
-        if (r == 0) return;
-    }
+    queue_event(INPUT_EVENT_MOUSE, id, state, x, y, 0, buttons);
 }
 
 EMSCRIPTEN_KEEPALIVE
 void core_on_pinch(int state, double x, double y, double scale,
                    int points_count)
 {
-    obj_t *module;
-    int r;
-    DL_FOREACH(core->obj.children, module) {
-        if (!module->klass->on_pinch) continue;
-        r = module->klass->on_pinch(module, state, x, y, scale, points_count);
-        if (r == 0) return;
-    }
+    queue_event(INPUT_EVENT_PINCH, 0, state, x, y, scale, points_count);
 }
 
 EMSCRIPTEN_KEEPALIVE
@@ -684,13 +911,7 @@ void core_on_char(uint32_t c)
 EMSCRIPTEN_KEEPALIVE
 void core_on_zoom(double k, double x, double y)
 {
-    obj_t *module;
-    DL_FOREACH(core->obj.children, module) {
-        if (module->klass->on_zoom) {
-            if (module->klass->on_zoom(module, k, x, y) == 0)
-                return;
-        };
-    }
+    queue_event(INPUT_EVENT_ZOOM, 0, 0, x, y, k, 0);
 }
 
 double core_mag_to_illuminance(double vmag)
@@ -1020,6 +1241,7 @@ static obj_klass_t core_klass = {
         PROPERTY(selection, TYPE_OBJ, MEMBER(core_t, selection)),
         PROPERTY(lock, TYPE_OBJ, MEMBER(core_t, target.lock)),
         PROPERTY(progressbars, TYPE_JSON, .fn = core_fn_progressbars),
+        PROPERTY(render_stats, TYPE_JSON, .fn = core_fn_render_stats),
         PROPERTY(fps, TYPE_INT, MEMBER(core_t, fps.avg)),
         PROPERTY(clicks, TYPE_INT, MEMBER(core_t, clicks)),
         PROPERTY(zoom, TYPE_FLOAT, MEMBER(core_t, zoom)),
@@ -1104,9 +1326,30 @@ static void test_info(void)
     obj_get_info(obj, core->observer, INFO_VMAG, &vmag);
 }
 
+static void test_input_events(void)
+{
+    core->inputs.nb_events = 0;
+    // Consecutive moves of the same touch are merged.
+    core_on_mouse(0, 1, 10, 10, 1);
+    core_on_mouse(0, -1, 11, 10, 1);
+    core_on_mouse(1, -1, 50, 50, 1);
+    core_on_mouse(0, -1, 12, 10, 1);
+    assert(core->inputs.nb_events == 3);
+    assert(core->inputs.events[1].pos[0] == 12);
+    // Zoom factors are accumulated.
+    core_on_zoom(2, 5, 5);
+    core_on_zoom(3, 6, 6);
+    assert(core->inputs.nb_events == 4);
+    assert(core->inputs.events[3].k == 6);
+    assert(core->inputs.events[3].pos[0] == 6);
+    // Don't send the events to the modules.
+    core->inputs.nb_events = 0;
+}
+
 TEST_REGISTER(NULL, test_core, TEST_AUTO);
 TEST_REGISTER(NULL, test_vec, TEST_AUTO);
 TEST_REGISTER(NULL, test_basic, TEST_AUTO);
 TEST_REGISTER(NULL, test_info, TEST_AUTO);
+TEST_REGISTER(NULL, test_input_events, TEST_AUTO);
 
 #endif
@@ -48,6 +48,20 @@ struct task
     void *user;
 };
 
+/*
+ * Type: input_event_t
+ * A mouse, pinch or zoom event waiting to be processed.
+ */
+typedef struct input_event
+{
+    int     type;
+    int     id;
+    int     state;
+    double  pos[2];
+    double  k;          // Zoom factor or pinch scale.
+    int     buttons;    // Or pinch points count.
+} input_event_t;
+
 /* Type: core_t
  * Contains all the modules and global state of the program.
  */
@@ -114,6 +128,9 @@ struct core
         } touches[2];
         bool        keys[512]; // Table of all key state.
         uint32_t    chars[16]; // Unicode characters.
+        // Events queued until the next core_update.
+        input_event_t events[64];
+        int         nb_events;
     } inputs;
     bool            gui_want_capture_mouse;
 
@@ -206,7 +223,22 @@ void core_release(void);
 int core_update(void);
 
 int core_render(double win_w, double win_h, double pixel_scale);
-// x and y in screen coordinates.
+/*
+ * Function: core_on_mouse
+ * Called from the client on mouse or touch events.
+ *
+ * Like <core_on_pinch> and <core_on_zoom>, the event is only queued, and
+ * processed at the next call to <core_update>.  Consecutive moves of the
+ * same touch are merged together.
+ *
+ * Parameters:
+ *   id      - Touch id, zero for the mouse.
+ *   state   - 1 if the button is down, 0 if up, -1 to keep the current
+ *             state (move).
+ *   x       - X position in windows coordinates.
+ *   y       - Y position in windows coordinates.
+ *   buttons - Mouse buttons mask.
+ */
 void core_on_mouse(int id, int state, double x, double y, int buttons);
 void core_on_key(int key, int action);
 void core_on_char(uint32_t c);
@@ -264,9 +296,40 @@ obj_t *core_get_obj_at(double x, double y, double max_dist);
  */
 obj_t *core_get_module(const char *id);
 
+/*
+ * Function: core_is_point_occulted
+ * Test if a point is hidden by a planet or any other occulter.
+ *
+ * The occulters are collected from the modules once per frame, and only
+ * the ones visible in the viewport are considered.
+ *
+ * Parameters:
+ *   pos    - ICRF position with origin on the observer (AU), or normalized
+ *            direction if at_inf is set.
+ *   at_inf - Set for the points at infinity.
+ *   obs    - The observer.
+ *   ignore - An object that should not hide the point.  Can be NULL.
+ */
 bool core_is_point_occulted(const double pos[3], bool at_inf,
                             const observer_t *obs, const obj_t *ignore);
 
+/*
+ * Function: core_are_points_occulted
+ * Same as <core_is_point_occulted> for several points at once.
+ *
+ * Parameters:
+ *   nb     - Number of points.
+ *   pos    - ICRF positions of the points.
+ *   at_inf - At infinity flag of each point.
+ *   ignore - Ignored occulter of each point (can contain NULL values).
+ *   obs    - The observer.
+ *   out    - Receive the result of each point.
+ */
+void core_are_points_occulted(int nb, const double (*pos)[3],
+                              const bool *at_inf,
+                              const obj_t *const *ignore,
+                              const observer_t *obs, bool *out);
+
 /*
  * Function: core_report_vmag_in_fov
  * Inform the core that an object with a given vmag is visible.
@@ -383,7 +383,7 @@ static int parse_anchor(const char *str)
 static int parse_properties(const json_value *data,
                             geojson_feature_properties_t *props)
 {
-    const char *title;
+    const char *title, *marker_symbol;
     const json_value *v;
     double text_offset[2];
     char error_msg[128] = "";
@@ -405,6 +405,9 @@ static int parse_properties(const json_value *data,
             ERROR("Can't parse text-offset");
         vec2_copy(text_offset, props->text_offset);
     }
+    if ((marker_symbol = json_get_attr_s(data, "marker-symbol")))
+        props->marker_symbol = strdup(marker_symbol);
+    props->marker_size = json_get_attr_f(data, "marker-size", 12);
     return 0;
 error:
     LOG_W("Error parsing geojson properties: %s", error_msg);
@@ -537,6 +540,7 @@ void geojson_delete(geojson_t *geojson)
     for (i = 0; i < geojson->nb_features; i++) {
         feature = &geojson->features[i];
         free(feature->properties.title);
+        free(feature->properties.marker_symbol);
         geo = &feature->geometry;
         switch (geo->type) {
         case GEOJSON_LINESTRING:
@@ -62,6 +62,10 @@
  *                  "top-left", "top-right", "bottom-left", "bottom-right".
  *   text-offset  - [x, y] offset in pixels.
  *   text-rotate  - rotation angle in degrees.
+ *   marker-symbol - An object type (eg "G" or "OpC") whose symbol is
+ *                   rendered at the point with the stroke color and a
+ *                   one pixel line.
+ *   marker-size  - Size of the symbol in pixels (default to 12).
  */
 
 enum {
@@ -99,6 +103,8 @@ typedef struct geojson_feature_properties
     float text_rotate;
     int text_size;
     float text_offset[2];
+    char *marker_symbol;
+    float marker_size;
 } geojson_feature_properties_t;
 
 typedef struct
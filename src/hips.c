@@ -21,6 +21,21 @@
 // past its limit if the items are still in use!
 #define CACHE_SIZE (256 * (1 << 20))
 
+// Max screen space error (in window pixels) allowed when choosing the number
+// of divisions of a rendered tile.
+#define SPLIT_MAX_ERR 0.5
+
+// Size of each of the twelve faces of the preview mosaics, and max order
+// of the tiles we can put in it.
+#define PREVIEW_FACE_SIZE 256
+#define PREVIEW_MAX_ORDER 5
+// Min delay between two saves of a preview mosaic (sec).
+#define PREVIEW_SAVE_DELAY 10.0
+
+// Max size reduction (as a power of two) of the tiles images decoded for
+// a coarse level of detail.
+#define DECODE_MAX_SHIFT 2
+
 // Flags of the tiles:
 enum {
     // Bit fields set by tile if we know that we don't have further tiles
@@ -46,6 +61,7 @@ struct tile {
     fader_t     fader;
     int         flags;
     void        *data;
+    int         decode_shift; // Size reduction requested for the image.
 
     // Loader to parse the image in a thread.
     struct {
@@ -54,6 +70,7 @@ struct tile {
         void *data;
         int size;
         int cost;
+        uint8_t *preview_cell; // Downsampled image for the preview.
     } *loader;
 };
 
@@ -71,11 +88,29 @@ typedef struct {
  * Type: img_tile_t
  * type data for images surveys.
  */
-typedef struct {
+typedef struct img_tile img_tile_t;
+struct img_tile {
+    // Decoded pixels.  They are freed as soon as the texture has been
+    // created, so the tile doesn't keep a CPU copy of the image.
     void        *img;
     int         w, h, bpp;
     texture_t   *tex;
-} img_tile_t;
+
+    // If the image has been decoded at a reduced size, we keep the source
+    // data so that we can decode it again at a higher resolution when
+    // the tile gets displayed larger.
+    int         shift;
+    void        *src;
+    int         src_size;
+
+    // Worker to decode the image again in a thread.
+    struct {
+        worker_t    worker;
+        img_tile_t  *tile;
+        uint8_t     *img;
+        int         w, h, bpp;
+    } *upgrade;
+};
 
 // Gobal cache for all the tiles.
 static cache_t *g_cache = NULL;
@@ -84,6 +119,9 @@ static cache_t *g_cache = NULL;
 static void *create_img_tile(
         void *user, int order, int pix, const void *src, int size,
         int *cost, int *transparency);
+static void *create_img_tile_scaled(
+        int order, int pix, const void *src, int size, int shift,
+        int *cost, int *transparency);
 static int delete_img_tile(void *tile);
 
 hips_t *hips_create(const char *url, double release_date,
@@ -117,8 +155,12 @@ void hips_delete(hips_t *hips)
     if (hips->ref > 0) return;
     free(hips->url);
     free(hips->service_url);
-    for (i = 0; i < 12; i++)
+    for (i = 0; i < 12; i++) {
         texture_release(hips->allsky.textures[i]);
+        texture_release(hips->preview.textures[i]);
+    }
+    free(hips->preview.path);
+    free(hips->preview.data);
     json_builder_free(hips->properties);
     free(hips);
 }
@@ -349,6 +391,219 @@ void hips_iter_push_children(hips_iterator_t *iter, int order, int pix)
 }
 
 
+/*
+ * Preview mosaic support.
+ *
+ * The mosaic is made of the twelve order zero faces, four per row, each
+ * laid out as an order zero tile would be, so that the tiles at order_min
+ * can be found in it the same way we find them in a parent tile.
+ */
+
+static bool preview_is_enabled(const hips_t *hips)
+{
+    return hips->settings.create_tile == create_img_tile &&
+           hips->order_min > 0 && hips->order_min <= PREVIEW_MAX_ORDER;
+}
+
+// Downsample a tile image into an RGBA preview cell.
+static uint8_t *preview_make_cell(const hips_t *hips, const img_tile_t *tile)
+{
+    int size = PREVIEW_FACE_SIZE >> hips->order_min;
+    int x, y, i, j, k, n, sum[4];
+    const uint8_t *p;
+    uint8_t *ret;
+
+    if (!tile || !tile->img || tile->w < size || tile->h < size)
+        return NULL;
+    ret = calloc(size * size, 4);
+    for (y = 0; y < size; y++)
+    for (x = 0; x < size; x++) {
+        memset(sum, 0, sizeof(sum));
+        n = 0;
+        for (i = y * tile->h / size; i < (y + 1) * tile->h / size; i++)
+        for (j = x * tile->w / size; j < (x + 1) * tile->w / size; j++) {
+            p = tile->img + (i * tile->w + j) * tile->bpp;
+            for (k = 0; k < 3; k++)
+                sum[k] += p[tile->bpp < 3 ? 0 : k];
+            sum[3] += (tile->bpp % 2 == 0) ? p[tile->bpp - 1] : 255;
+            n++;
+        }
+        for (k = 0; k < 4; k++)
+            ret[(y * size + x) * 4 + k] = sum[k] / n;
+    }
+    return ret;
+}
+
+// Copy a downsampled tile into the preview mosaic.
+static void preview_add_cell(hips_t *hips, int pix, const uint8_t *cell)
+{
+    const int w = PREVIEW_FACE_SIZE * 4;
+    int order = hips->order_min, face, size, x, y, i, q;
+
+    if (!hips->preview.data)
+        hips->preview.data = calloc(w * PREVIEW_FACE_SIZE * 3, 4);
+    face = pix >> (2 * order);
+    x = (face % 4) * PREVIEW_FACE_SIZE;
+    y = (face / 4) * PREVIEW_FACE_SIZE;
+    size = PREVIEW_FACE_SIZE;
+    for (i = order - 1; i >= 0; i--) {
+        q = (pix >> (2 * i)) % 4;
+        size /= 2;
+        x += (q / 2) * size;
+        y += (q % 2) * size;
+    }
+    for (i = 0; i < size; i++) {
+        memcpy(hips->preview.data + ((y + i) * w + x) * 4,
+               cell + i * size * 4, size * 4);
+    }
+    hips->preview.dirty = true;
+    // Force to recreate the face texture.
+    texture_release(hips->preview.textures[face]);
+    hips->preview.textures[face] = NULL;
+}
+
+/*
+ * Return the preview texture of a tile at order_min, and update the
+ * transf matrix to the part of the texture covering the tile.
+ */
+static texture_t *preview_get_texture(hips_t *hips, int pix,
+                                      double transf[3][3])
+{
+    int order = hips->order_min, face, i, q;
+
+    if (!hips->preview.data) return NULL;
+    face = pix >> (2 * order);
+    if (!hips->preview.textures[face]) {
+        hips->preview.textures[face] = texture_from_data(
+                hips->preview.data,
+                PREVIEW_FACE_SIZE * 4, PREVIEW_FACE_SIZE * 3, 4,
+                (face % 4) * PREVIEW_FACE_SIZE,
+                (face / 4) * PREVIEW_FACE_SIZE,
+                PREVIEW_FACE_SIZE, PREVIEW_FACE_SIZE, 0);
+    }
+    if (transf) {
+        for (i = order - 1; i >= 0; i--) {
+            q = (pix >> (2 * i)) % 4;
+            mat3_iscale(transf, 0.5, 0.5, 1.0);
+            mat3_itranslate(transf, q / 2, q % 2);
+        }
+    }
+    return hips->preview.textures[face];
+}
+
+static int load_preview_worker(worker_t *worker)
+{
+    typeof(((hips_t*)0)->preview) *preview = (void*)worker;
+    int w, h, bpp = 4;
+    preview->data = img_read(preview->path, &w, &h, &bpp);
+    if (preview->data &&
+            (w != PREVIEW_FACE_SIZE * 4 || h != PREVIEW_FACE_SIZE * 3)) {
+        free(preview->data);
+        preview->data = NULL;
+    }
+    return 0;
+}
+
+static int save_preview_worker(worker_t *worker)
+{
+    typeof(((hips_t*)0)->preview) *preview = (void*)worker;
+    if (sys_make_dir(preview->path) == 0) {
+        img_write(preview->save_data, PREVIEW_FACE_SIZE * 4,
+                  PREVIEW_FACE_SIZE * 3, 4, preview->path);
+    }
+    free(preview->save_data);
+    preview->save_data = NULL;
+    return 0;
+}
+
+/*
+ * Load the saved preview at startup, and save it again from time to time
+ * when new tiles have been added to it.
+ *
+ * Return false if the preview is still loading.
+ */
+static bool preview_update(hips_t *hips)
+{
+    int size;
+    if (!preview_is_enabled(hips)) return true;
+
+    if (!hips->preview.path) {
+        asprintf(&hips->preview.path, "%s/.cache/previews/%08x_%d.png",
+                 sys_get_user_dir(), hips->hash, (int)hips->release_date);
+        worker_init(&hips->preview.worker, load_preview_worker);
+        hips->ref++;
+    }
+
+    if (hips->preview.worker.fn) {
+        if (!worker_iter(&hips->preview.worker)) {
+            // Only wait if we are loading the image.
+            return hips->preview.save_data != NULL;
+        }
+        hips_delete(hips); // Release ref from worker.
+        hips->preview.worker.fn = NULL;
+        hips->preview.last_save = sys_get_unix_time();
+    }
+
+    if (hips->preview.dirty &&
+            sys_get_unix_time() - hips->preview.last_save >
+            PREVIEW_SAVE_DELAY) {
+        size = PREVIEW_FACE_SIZE * PREVIEW_FACE_SIZE * 12 * 4;
+        hips->preview.save_data = malloc(size);
+        memcpy(hips->preview.save_data, hips->preview.data, size);
+        hips->preview.dirty = false;
+        worker_init(&hips->preview.worker, save_preview_worker);
+        hips->ref++;
+    }
+    return true;
+}
+
+static int upgrade_img_tile_worker(worker_t *worker)
+{
+    typeof(((img_tile_t*)0)->upgrade) upgrade = (void*)worker;
+    const img_tile_t *tile = upgrade->tile;
+    upgrade->bpp = 0;
+    upgrade->img = img_read_from_mem(tile->src, tile->src_size,
+                                     &upgrade->w, &upgrade->h, &upgrade->bpp);
+    return 0;
+}
+
+/*
+ * Decode again at full size an image tile that was decoded at a reduced
+ * size.  The decoding is done in a thread, and the tile keeps its current
+ * texture until the new image is ready.
+ */
+static void img_tile_upgrade(hips_t *hips, int order, int pix,
+                             img_tile_t *tile)
+{
+    tile_key_t key = {hips->hash, order, pix};
+    if (!tile->src) return;
+    if (!tile->upgrade) {
+        tile->upgrade = calloc(1, sizeof(*tile->upgrade));
+        worker_init(&tile->upgrade->worker, upgrade_img_tile_worker);
+        tile->upgrade->tile = tile;
+    }
+    if (!worker_iter(&tile->upgrade->worker)) return;
+    if (tile->upgrade->img) {
+        free(tile->img);
+        texture_release(tile->tex);
+        tile->tex = NULL;
+        tile->img = tile->upgrade->img;
+        tile->w = tile->upgrade->w;
+        tile->h = tile->upgrade->h;
+        tile->bpp = tile->upgrade->bpp;
+        tile->shift = 0;
+        cache_set_cost(g_cache, &key, sizeof(key),
+                       tile->w * tile->h * tile->bpp);
+    } else {
+        LOG_W("Cannot parse img");
+        tile->shift = 0; // Don't try again.
+    }
+    free(tile->src);
+    tile->src = NULL;
+    free(tile->upgrade);
+    tile->upgrade = NULL;
+}
+
 /*
  * Function: hips_get_tile_texture
  * Get the texture for a given hips tile.
@@ -397,8 +652,18 @@ texture_t *hips_get_tile_texture(
             *loading_complete = true;
     }
 
-    // Create texture if needed.
-    if (tile && tile->img && !tile->tex) {
+    // Decode the image again if it is displayed larger than the size it
+    // was decoded at.
+    if (tile && tile->shift > (order == hips->order_min ?
+                               hips->decode_shift : 0)) {
+        img_tile_upgrade(hips, order, pix, tile);
+    }
+
+    // Create texture if needed.  The upload might be postponed to a later
+    // frame if we already uploaded too much data during this one, in which
+    // case we use the parent tiles in the meantime.
+    if (tile && tile->img && !tile->tex &&
+            texture_upload_request(tile->w * tile->h * tile->bpp)) {
         tile->tex = texture_from_data(tile->img, tile->w, tile->h, tile->bpp,
                                       0, 0, tile->w, tile->h, 0);
         free(tile->img);
@@ -427,8 +692,11 @@ texture_t *hips_get_tile_texture(
     }
 
     // If we didn't find the tile, or the texture is not loaded yet,
-    // fallback to one of the parent tile texture.
-    if (order == hips->order_min) return NULL; // No parent.
+    // fallback to one of the parent tile texture, or to the preview.
+    if (order == hips->order_min) {
+        if (!preview_is_enabled(hips)) return NULL; // No parent.
+        return preview_get_texture(hips, pix, transf);
+    }
     tex = hips_get_tile_texture(
             hips, order - 1, pix / 4, flags, transf, NULL, NULL);
     if (!tex) return NULL;
@@ -465,23 +733,76 @@ static int render_visitor(hips_t *hips, const painter_t *painter_,
     uv_map_init_healpix(&map, order, pix, false, true);
     if (transf)
         map.transf = (const void*)transf;
+    split = painter_get_quad_split(&painter, hips->frame, &map, split,
+                                   SPLIT_MAX_ERR);
     paint_quad(&painter, hips->frame, &map, split);
     return 0;
 }
 
+static int drop_tile_filter(void *data, void *user)
+{
+    const tile_t *tile = data;
+    const hips_t *hips = USER_GET(user, 0);
+    int max_order = *(int*)USER_GET(user, 1);
+    return tile->hips == hips && tile->pos.order > max_order;
+}
+
+/*
+ * Release all the tiles of a survey with an order higher than a given
+ * value.
+ */
+static void drop_tiles(hips_t *hips, int max_order)
+{
+    cache_evict(g_cache, drop_tile_filter, USER_PASS(hips, &max_order));
+}
+
+// Rendered tile, with its priority for the textures upload.
+typedef struct {
+    int order;
+    int pix;
+    double priority;
+} render_item_t;
+
+static int render_item_cmp(const void *a, const void *b)
+{
+    return cmp(((const render_item_t*)b)->priority,
+               ((const render_item_t*)a)->priority);
+}
+
+/*
+ * Compute the priority of a tile, so that the tiles closer to the center
+ * of the screen get their textures uploaded first.
+ */
+static double get_tile_priority(const hips_t *hips, const painter_t *painter,
+                                const double transf[4][4], int order, int pix)
+{
+    double pos[3];
+    healpix_pix2vec(1 << order, pix, pos);
+    if (transf) {
+        mat4_mul_vec3(transf, pos, pos);
+        vec3_normalize(pos, pos);
+    }
+    return vec3_dot(pos, painter->clip_info[hips->frame].bounding_cap);
+}
+
 int hips_render(hips_t *hips, const painter_t *painter,
                 const double transf[4][4], int split_order)
 {
-    int nb_tot = 0, nb_loaded = 0;
-    int render_order, order, pix, split;
+    int nb_tot = 0, nb_loaded = 0, nb = 0, allocated = 0, i;
+    int render_order, order, pix, split, code;
     hips_iterator_t iter;
     uv_map_t map;
+    render_item_t *items = NULL;
 
     assert(split_order >= 0);
     if (painter->color[3] == 0.0) return 0;
     if (!hips_is_ready(hips)) return 0;
 
     render_order = hips_get_render_order(hips, painter);
+    // When the tiles at order_min are displayed smaller than their actual
+    // resolution, we can decode them at a reduced size.
+    hips->decode_shift = clamp(hips->order_min - render_order,
+                               0, DECODE_MAX_SHIFT);
     // Clamp the render order into physically possible range.
     render_order = clamp(render_order, hips->order_min, hips->order);
     render_order = fmin(render_order, 9); // Hard limit.
@@ -489,24 +810,51 @@ int hips_render(hips_t *hips, const painter_t *painter,
     // Can't split less than the rendering order.
     split_order = fmax(split_order, render_order);
 
+    // Keep one extra level so that we can zoom in and out a bit without
+    // reloading the tiles.
+    if (hips->streaming && render_order < hips->last_render_order)
+        drop_tiles(hips, render_order + 1);
+    hips->last_render_order = render_order;
+
     // Breath first traversal of all the tiles.
     hips_iter_init(&iter);
     while (hips_iter_next(&iter, &order, &pix)) {
         // Early exit if the tile is clipped.
         uv_map_init_healpix(&map, order, pix, false, false);
         map.transf = (const void*)transf;
-        if (painter_is_quad_clipped(painter, hips->frame, &map))
+        if (painter_is_quad_clipped(painter, hips->frame, &map)) {
+            // The parent of this tile is visible, so it is just outside
+            // of the viewport.  Load it in advance if we are streaming.
+            if (hips->streaming && order == render_order)
+                hips_get_tile(hips, order, pix, HIPS_LOAD_IN_THREAD, &code);
             continue;
+        }
         if (order < render_order) { // Keep going.
             hips_iter_push_children(&iter, order, pix);
             continue;
         }
-        split = 1 << (split_order - render_order);
-        render_visitor(hips, painter, transf, order, pix, split,
-                       &nb_tot, &nb_loaded);
+        if (nb >= allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            items = realloc(items, allocated * sizeof(*items));
+        }
+        items[nb++] = (render_item_t) {
+            .order = order,
+            .pix = pix,
+            .priority = get_tile_priority(hips, painter, transf, order, pix),
+        };
     }
 
+    // Render the tiles from the center of the screen to the edges.
+    qsort(items, nb, sizeof(*items), render_item_cmp);
+    split = 1 << (split_order - render_order);
+    for (i = 0; i < nb; i++) {
+        render_visitor(hips, painter, transf, items[i].order, items[i].pix,
+                       split, &nb_tot, &nb_loaded);
+    }
+    free(items);
+
     progressbar_report(hips->url, hips->label, nb_loaded, nb_tot, -1);
+    hips->decode_shift = 0;
     return 0;
 }
 
@@ -583,7 +931,7 @@ bool hips_update(hips_t *hips)
         hips->allsky.worker.fn = NULL;
     }
 
-    return true;
+    return preview_update(hips);
 }
 
 bool hips_is_ready(hips_t *hips)
@@ -642,17 +990,33 @@ int hips_get_render_order_planet(const hips_t *hips, const painter_t *painter,
     return ceil(order + 1);
 }
 
+// Create the tile data, with a reduced size decoding for image tiles.
+static void *create_tile_data(const tile_t *tile, const void *data, int size,
+                              int *cost, int *transparency)
+{
+    const hips_t *hips = tile->hips;
+    if (hips->settings.create_tile == create_img_tile) {
+        return create_img_tile_scaled(tile->pos.order, tile->pos.pix,
+                                      data, size, tile->decode_shift,
+                                      cost, transparency);
+    }
+    return hips->settings.create_tile(
+            hips->settings.user, tile->pos.order, tile->pos.pix,
+            data, size, cost, transparency);
+}
+
 static int load_tile_worker(worker_t *worker)
 {
     int transparency = 0;
     typeof(((tile_t*)0)->loader) loader = (void*)worker;
     tile_t *tile = loader->tile;
     hips_t *hips = tile->hips;
-    tile->data = hips->settings.create_tile(
-                    hips->settings.user, tile->pos.order, tile->pos.pix,
-                    loader->data, loader->size, &loader->cost, &transparency);
+    tile->data = create_tile_data(tile, loader->data, loader->size,
+                                  &loader->cost, &transparency);
     if (!tile->data) tile->flags |= TILE_LOAD_ERROR;
     tile->flags |= (transparency * TILE_NO_CHILD_0);
+    if (tile->pos.order == hips->order_min && preview_is_enabled(hips))
+        loader->preview_cell = preview_make_cell(hips, tile->data);
     free(loader->data);
     return 0;
 }
@@ -663,6 +1027,7 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
     const void *data;
     int size, parent_code, asset_flags, cost = 0, transparency = 0;
     char url[URL_MAX_SIZE];
+    uint8_t *cell;
     tile_t *tile, *parent;
     tile_key_t key = {hips->hash, order, pix};
 
@@ -676,6 +1041,10 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
     if (tile && tile->loader) {
         if (!worker_iter(&tile->loader->worker)) return NULL;
         cache_set_cost(g_cache, &key, sizeof(key), tile->loader->cost);
+        if (tile->loader->preview_cell) {
+            preview_add_cell(hips, pix, tile->loader->preview_cell);
+            free(tile->loader->preview_cell);
+        }
         free(tile->loader);
         tile->loader = NULL;
     }
@@ -735,19 +1104,24 @@ static tile_t *hips_get_tile_(hips_t *hips, int order, int pix, int flags,
     tile->pos.order = order;
     tile->pos.pix = pix;
     tile->hips = hips;
+    if (order == hips->order_min) tile->decode_shift = hips->decode_shift;
     hips->ref++;
     cache_add(g_cache, &key, sizeof(key), tile, sizeof(*tile) + cost,
               del_tile);
 
     if (!(flags & HIPS_LOAD_IN_THREAD)) {
-        tile->data = hips->settings.create_tile(
-                hips->settings.user, order, pix, data, size,
-                &cost, &transparency);
+        tile->data = create_tile_data(tile, data, size, &cost,
+                                      &transparency);
         tile->flags |= (transparency * TILE_NO_CHILD_0);
         if (!tile->data) {
             LOG_W("Cannot parse tile %s", url);
             tile->flags |= TILE_LOAD_ERROR;
         }
+        if (order == hips->order_min && preview_is_enabled(hips)) {
+            cell = preview_make_cell(hips, tile->data);
+            if (cell) preview_add_cell(hips, pix, cell);
+            free(cell);
+        }
         asset_release(url);
     } else {
         tile->loader = calloc(1, sizeof(*tile->loader));
@@ -776,6 +1150,14 @@ void *hips_get_tile(hips_t *hips, int order, int pix, int flags, int *code)
 static void *create_img_tile(
         void *user, int order, int pix, const void *data, int size,
         int *cost, int *transparency)
+{
+    return create_img_tile_scaled(order, pix, data, size, 0,
+                                  cost, transparency);
+}
+
+static void *create_img_tile_scaled(
+        int order, int pix, const void *data, int size, int shift,
+        int *cost, int *transparency)
 {
     void *img;
     int i, w, h, bpp = 0;
@@ -787,7 +1169,9 @@ static void *create_img_tile(
         return tile;
     }
 
-    img = img_read_from_mem(data, size, &w, &h, &bpp);
+    // Only WebP tiles can be decoded at a reduced size, shift is set to
+    // the reduction actually applied.
+    img = img_read_from_mem_scaled(data, size, &shift, &w, &h, &bpp);
     if (!img) {
         LOG_W("Cannot parse img");
         return NULL;
@@ -805,13 +1189,26 @@ static void *create_img_tile(
         }
     }
     *cost = w * h * bpp;
+    if (shift) {
+        tile->shift = shift;
+        tile->src = malloc(size);
+        tile->src_size = size;
+        memcpy(tile->src, data, size);
+        *cost += size;
+    }
     return tile;
 }
 
 static int delete_img_tile(void *tile_)
 {
     img_tile_t *tile = tile_;
+    if (tile->upgrade && worker_is_running(&tile->upgrade->worker))
+        return CACHE_KEEP;
     texture_release(tile->tex);
+    free(tile->upgrade ? tile->upgrade->img : NULL);
+    free(tile->upgrade);
+    free(tile->src);
+    free(tile->img);
     free(tile);
     return 0;
 }
@@ -80,11 +80,33 @@ struct hips {
         texture_t   *textures[12];
     }           allsky;
 
+    // Low resolution mosaic of the twelve base pixels, built from the
+    // loaded tiles at order_min and saved in the cache directory, so that
+    // we can render a preview of the full sky as soon as the survey is
+    // created at the next launch.
+    struct {
+        worker_t    worker; // Worker to load or save the image in a thread.
+        char        *path;  // Path of the saved image.
+        uint8_t     *data;  // RGBA image with the twelve faces.
+        uint8_t     *save_data; // Copy of the image being saved.
+        bool        dirty;  // Set if the image changed since last save.
+        double      last_save; // Unix time of the last save.
+        texture_t   *textures[12];
+    }           preview;
+
     // Contains all the properties as a json object.
     json_value *properties;
     int order;
     int order_min;
     int tile_width;
+    // Size reduction (as a power of two) used to decode the tiles at
+    // order_min.  Only set during hips_render.
+    int decode_shift;
+    // If set, hips_render also loads the tiles just outside of the
+    // viewport, and releases the tiles finer than needed when we zoom out.
+    // Used for the static layers like the milky way or the landscapes.
+    bool streaming;
+    int last_render_order; // Render order of the last hips_render call.
 
     // The settings as passed in the create function.
     hips_settings_t settings;
@@ -299,9 +321,11 @@ int hips_get_render_order_planet(const hips_t *hips, const painter_t *painter,
  *   painter - The painter used to render.
  *   transf  - Transformation applied to the unit sphere to set the position
  *             in the sky.  Can be set to NULL for identity.
- *   split_order - The requested order of the final quad divisions.
- *                 The actual split order could be higher if the rendering
- *                 order is too high for this value.
+ *   split_order - The max order of the final quad divisions.  Each
+ *                 tile is only split as much as needed for its projection
+ *                 error to stay under half a pixel.  The actual split
+ *                 order could be higher if the rendering order is too
+ *                 high for this value.
  */
 int hips_render(hips_t *hips, const painter_t *painter,
                 const double transf[4][4], int split_order);
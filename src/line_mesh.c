@@ -204,12 +204,9 @@ int line_tesselate(void (*func)(void *user, double t, double pos[3]),
         size = split + 1;
         *out_pos = calloc(size, sizeof(**out_pos));
         *out_win = calloc(size, sizeof(**out_win));
-        for (i = 0; i < size; i++) {
-            func(user, (double)i / split, pos);
-            project_to_win(proj, pos, win);
-            vec3_copy(pos, (*out_pos)[i]);
-            vec3_copy(win, (*out_win)[i]);
-        }
+        for (i = 0; i < size; i++)
+            func(user, (double)i / split, (*out_pos)[i]);
+        project_to_win_n(proj, size, *out_pos, *out_win);
     } else {
         min_level = -split;
         func(user, 0, pos);
@@ -34,6 +34,7 @@ static struct {
 typedef struct cardinal {
     obj_t obj;
     fader_t         visible;
+    paint_cache_t   cache;  // Render items of the previous frames.
 } cardinal_t;
 
 static int cardinal_init(obj_t *obj, json_value *args)
@@ -53,29 +54,39 @@ static int cardinal_render(obj_t *obj, const painter_t *painter)
 {
     int i;
     double size = 24;
-    const cardinal_t *c = (const cardinal_t*)obj;
+    cardinal_t *c = (cardinal_t*)obj;
     double color[4] = {0.8, 0.4, 0.4, 0.8 * c->visible.value};
     double p[4];
+    painter_t _painter = *painter;
+    uint32_t key;
+    bool replayed;
 
     if (c->visible.value <= 0) return 0;
+
+    _painter.color[0] = color[0];
+    _painter.color[1] = color[1];
+    _painter.color[2] = color[2];
+    _painter.color[3] = c->visible.value;
+    _painter.lines.width = 4;
+    key = painter_get_cache_key(&_painter, NULL, 0);
+    replayed = paint_cache_replay(&_painter, &c->cache, key);
+    if (!replayed) paint_cache_record_begin(&_painter);
+
     for (i = 0; i < 4; i++) {
         if (painter_is_point_clipped_fast(painter, FRAME_OBSERVED,
                 POINTS[i].pos, true))
             continue;
-        convert_frame(painter->obs, FRAME_OBSERVED, FRAME_VIEW, true,
-                      POINTS[i].pos, p);
-        project_to_win(painter->proj, p, p);
-        painter_t _painter = *painter;
-        _painter.color[0] = color[0];
-        _painter.color[1] = color[1];
-        _painter.color[2] = color[2];
-        _painter.color[3] = c->visible.value;
-        _painter.lines.width = 4;
-        paint_2d_ellipse(&_painter, NULL, 0, p, VEC(1, 1), NULL);
+        if (!replayed) {
+            convert_frame(painter->obs, FRAME_OBSERVED, FRAME_VIEW, true,
+                          POINTS[i].pos, p);
+            project_to_win(painter->proj, p, p);
+            paint_2d_ellipse(&_painter, NULL, 0, p, VEC(1, 1), NULL);
+        }
         labels_add_3d(sys_translate("gui", POINTS[i].text), FRAME_OBSERVED,
                       POINTS[i].pos, true, 0, size, color, 0,
                       ALIGN_CENTER | ALIGN_TOP, TEXT_BOLD, 0, NULL);
     }
+    if (!replayed) paint_cache_record_end(&_painter, &c->cache, key);
     return 0;
 }
 
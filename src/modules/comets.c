@@ -24,6 +24,13 @@ enum {
     TAIL_DUST,
 };
 
+// Relative change of the comet-sun vector above which the cached tail
+// geometry gets recomputed.
+#define TAIL_CACHE_TOLERANCE 0.01
+// Tails with an apparent length smaller than this (in pixels) are not
+// rendered at all.
+#define TAIL_MIN_PIXELS 4.0
+
 typedef struct orbit_t {
     double d;    // date (julian day).
     double i;    // inclination (rad).
@@ -34,6 +41,22 @@ typedef struct orbit_t {
     double q;    // Perihelion distance (AU).
 } orbit_t;
 
+/*
+ * Type: tail_t
+ * Cached geometry of a comet tail, in the comet local frame.
+ *
+ * The tail shape only depends on the comet-sun vector (and the magnitude
+ * parameters), so we only recompute it when those changed enough.
+ */
+typedef struct tail {
+    double ph[3];       // Comet-sun vector used to compute the values.
+    double h, g;        // Magnitude parameters used to compute the values.
+    double mat[4][4];   // Model matrix relative to the coma position.
+    double l;           // Tail length (AU).
+    double d;           // Tail width (AU).
+    double curvature;
+} tail_t;
+
 /*
  * Type: comet_t
  * Object that represents a single comet
@@ -60,6 +83,7 @@ struct comet {
     // Cached values.
     double      vmag;
     double      pvo[2][4];
+    tail_t      tails[2]; // Indexed by TAIL_GAS and TAIL_DUST.
 
     // Linked list of currently visible.
     comet_t     *visible_next, *visible_prev;
@@ -388,34 +412,73 @@ static void mat_rotate_y_toward(double mat[4][4], double dir[3])
     mat4_mul(mat, rot, mat);
 }
 
+/*
+ * Return the cached geometry of a comet tail, recomputing it only if the
+ * comet moved significantly relative to the sun since the last call.
+ */
+static const tail_t *get_tail(comet_t *comet, const observer_t *obs,
+                              int tail)
+{
+    tail_t *t = &comet->tails[tail];
+    double ph[3], rh, dir[3], h, g;
+    double mat[4][4] = MAT4_IDENTITY;
+
+    vec3_sub(comet->pvo[0], obs->sun_pvo[0], ph);
+    rh = vec3_norm(ph);
+    comet_get_h_g(comet, obs->tt, &h, &g);
+    if (vec3_dist(ph, t->ph) < rh * TAIL_CACHE_TOLERANCE &&
+            t->h == h && t->g == g)
+        return t;
+
+    vec3_copy(ph, t->ph);
+    t->h = h;
+    t->g = g;
+    compute_tail_size(h, g, rh, &t->l, &t->d);
+    t->curvature = 0;
+
+    switch (tail) {
+    case TAIL_GAS:
+        mat_rotate_y_toward(mat, ph);
+        // Rotate along axis so that both tails don't look exactly the same.
+        mat4_ry(M_PI / 2, mat, mat);
+        break;
+    case TAIL_DUST:
+        // Empirical size adjustement to the dust tail size.
+        t->d *= 1.5;
+        t->l *= 0.6;
+        t->curvature = -M_PI;
+        vec3_addk(ph, comet->pvo[1], -5, dir);
+        mat_rotate_y_toward(mat, dir);
+        break;
+    }
+
+    // Translate to put the orgin in the middle of the coma.
+    mat4_itranslate(mat, 0, -0.0001, 0);
+    mat4_iscale(mat, t->d / 2, t->l, t->d / 2);
+    mat4_copy(mat, t->mat);
+    return t;
+}
+
 static void render_tail(comet_t *comet, const painter_t *painter, int tail)
 {
     double model_mat[4][4] = MAT4_IDENTITY;
-    double ph[3], rh, l, d, angle, point, dir[3], curvature = 0, h, g;
-    double color[4], lum_apparent, ld;
+    double dist, angle, point, length, color[4], lum_apparent, ld;
+    const tail_t *t;
     json_value *args, *uniforms;
 
-    vec3_sub(comet->pvo[0], painter->obs->sun_pvo[0], ph);
-    rh = vec3_norm(ph);
-    comet_get_h_g(comet, painter->obs->tt, &h, &g);
-    compute_tail_size(h, g, rh, &l, &d);
-    mat4_itranslate(model_mat, VEC3_SPLIT(comet->pvo[0]));
+    t = get_tail(comet, painter->obs, tail);
+    dist = vec3_norm(comet->pvo[0]);
+
+    // Skip the tail if it would be too small on screen.
+    length = core_get_point_for_apparent_angle(painter->proj, t->l / dist);
+    if (length < TAIL_MIN_PIXELS) return;
 
     switch (tail) {
     case TAIL_GAS:
         vec4_set(color, 0.15, 0.35, 0.6, 0.25);
-        mat_rotate_y_toward(model_mat, ph);
-        // Rotate along axis so that both tails don't look exactly the same.
-        mat4_ry(M_PI / 2, model_mat, model_mat);
         break;
     case TAIL_DUST:
-        // Empirical size adjustement to the dust tail size.
-        d *= 1.5;
-        l *= 0.6;
-        curvature = -M_PI;
         vec4_set(color, 0.7, 0.7, 0.4, 1.0);
-        vec3_addk(ph, comet->pvo[1], -5, dir);
-        mat_rotate_y_toward(model_mat, dir);
         break;
     }
 
@@ -423,7 +486,7 @@ static void render_tail(comet_t *comet, const painter_t *painter, int tail)
     // XXX: this is ad-hoc, I have to manually make the tail brigher than
     // it should.  Also since we don't report the luminance to the
     // tonemapper I manually dim out the tail as we zoom in!
-    angle = d / vec3_norm(comet->pvo[0]);
+    angle = t->d / dist;
     lum_apparent = core_mag_to_lum_apparent(
             comet->vmag - 4, M_PI * angle * angle);
     ld = tonemapper_map(&core->tonemapper, lum_apparent);
@@ -433,16 +496,15 @@ static void render_tail(comet_t *comet, const painter_t *painter, int tail)
     color[3] *= smoothstep(1000, 100, point);
     if (color[3] <= 0.0) return;
 
-    // Translate to put the orgin in the middle of the coma.
-    mat4_itranslate(model_mat, 0, -0.0001, 0);
-    mat4_iscale(model_mat, d / 2, l, d / 2);
+    mat4_itranslate(model_mat, VEC3_SPLIT(comet->pvo[0]));
+    mat4_mul(model_mat, t->mat, model_mat);
 
     args = json_object_new(0);
     json_object_push(args, "shader", json_string_new("comet"));
     json_object_push(args, "blend_mode", json_string_new("ADD"));
     uniforms = json_object_push(args, "uniforms", json_object_new(0));
-    json_object_push(uniforms, "u_length", json_double_new(l));
-    json_object_push(uniforms, "u_curvature", json_double_new(curvature));
+    json_object_push(uniforms, "u_length", json_double_new(t->l));
+    json_object_push(uniforms, "u_curvature", json_double_new(t->curvature));
     json_object_push(uniforms, "u_color", json_vector_new(4, color));
 
     paint_3d_model(painter, "comet", model_mat, args);
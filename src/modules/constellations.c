@@ -42,6 +42,7 @@ typedef struct constellation {
         obj_t       **stars;
         double      (*stars_pos)[3]; // ICRF/observer pos for all stars.
         double      cap[4];  // Bounding cap of the lines (ICRF).
+        paint_cache_t cache;
     } lines;
 
     // Texture and associated transformation matrix.
@@ -51,8 +52,11 @@ typedef struct constellation {
         obj_t       *anchors_stars[3];
         double      mat[3][3];
         double      cap[4]; // Bounding cap of the image (ICRF)
+        paint_cache_t cache;
     } img;
 
+    paint_cache_t bounds_cache;
+
     bool error; // Set if we couldn't parse the stars.
 
     double last_update; // Last update time in TT
@@ -491,13 +495,14 @@ static void spherical_project(
     mat3_mul_vec3(rnpb, out, out);
 }
 
-static int render_bounds(const constellation_t *con,
+static int render_bounds(constellation_t *con,
                          const painter_t *painter_,
                          bool selected)
 {
     int i;
     const constellation_infos_t *info;
     double line[2][4] = {};
+    uint32_t key;
     painter_t painter = *painter_;
     const constellations_t *cons = (const constellations_t*)con->obj.parent;
     uv_map_t map = {
@@ -522,6 +527,9 @@ static int render_bounds(const constellation_t *con,
     painter.lines.dash_length = 8;
     info = &con->info;
     if (!info) return 0;
+    key = painter_get_cache_key(&painter, NULL, 0);
+    if (paint_cache_replay(&painter, &con->bounds_cache, key)) return 0;
+    paint_cache_record_begin(&painter);
     for (i = 0; i < info->nb_edges; i++) {
         memcpy(line[0], info->edges[i][0], 2 * sizeof(double));
         memcpy(line[1], info->edges[i][1], 2 * sizeof(double));
@@ -529,6 +537,7 @@ static int render_bounds(const constellation_t *con,
         paint_line(&painter, FRAME_ICRF, line, &map, 0,
                    PAINTER_SKIP_DISCONTINUOUS);
     }
+    paint_cache_record_end(&painter, &con->bounds_cache, key);
     return 0;
 }
 
@@ -546,7 +555,7 @@ static bool constellation_lines_in_view(const constellation_t *con,
                                         const painter_t *painter)
 {
     int i, nb = 0;
-    double (*pos)[4], mx, my;
+    double (*pos)[4], (*view)[3], mx, my;
     bool ret;
     const double m = 100; // Border margins (windows unit).
 
@@ -560,13 +569,15 @@ static bool constellation_lines_in_view(const constellation_t *con,
 
     // Clipping test.
     pos = calloc(con->lines.nb_stars, sizeof(*pos));
+    view = calloc(con->lines.nb_stars, sizeof(*view));
     for (i = 0; i < con->lines.nb_stars; i++) {
         if (!con->lines.stars[i]) continue;
         convert_frame(painter->obs, FRAME_ICRF, FRAME_VIEW, true,
-                      con->lines.stars_pos[i], pos[nb]);
-        project_to_clip(painter->proj, pos[nb], pos[nb]);
+                      con->lines.stars_pos[i], view[nb]);
         nb++;
     }
+    project_to_clip_n(painter->proj, nb, view, pos);
+    free(view);
     if (nb == 0) {
         free(pos);
         return true;
@@ -635,6 +646,7 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
     double (*lines)[4];
     double lines_color[4];
     double mag[2], radius[2], visible, opacity;
+    uint32_t key;
     const observer_t *obs = painter.obs;
     const constellations_t *cons = (const constellations_t*)con->obj.parent;
 
@@ -675,6 +687,16 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
             line_animation_effect(&lines[i], visible * 2);
     }
 
+    // The truncated lines are part of the key, so that we only replay the
+    // cached items if the stars didn't move.
+    key = painter_get_cache_key(&painter, lines,
+                                con->lines.nb_stars * sizeof(*lines));
+    if (paint_cache_replay(&painter, &con->lines.cache, key)) {
+        free(lines);
+        return 0;
+    }
+    paint_cache_record_begin(&painter);
+
     opacity = painter.color[3];
     for (i = 0; i < con->lines.nb_stars; i += 2) {
         if (!con->lines.stars[i + 0] || !con->lines.stars[i + 1]) continue;
@@ -686,6 +708,7 @@ static int render_lines(constellation_t *con, const painter_t *_painter,
         paint_line(&painter, FRAME_ICRF, lines + i, NULL, 1,
                    PAINTER_SKIP_DISCONTINUOUS);
     }
+    paint_cache_record_end(&painter, &con->lines.cache, key);
 
     free(lines);
 
@@ -706,6 +729,7 @@ static int render_img(constellation_t *con, const painter_t *painter_,
 {
     uv_map_t map = {0};
     painter_t painter = *painter_;
+    uint32_t key;
     const constellations_t *cons = (const constellations_t*)con->obj.parent;
 
     // Fade out image as we zoom in.
@@ -733,7 +757,11 @@ static int render_img(constellation_t *con, const painter_t *painter_,
     mat3_copy(con->img.mat, map.mat);
     map.map = img_map;
     painter_set_texture(&painter, PAINTER_TEX_COLOR, con->img.tex, NULL);
+    key = painter_get_cache_key(&painter, map.mat, sizeof(map.mat));
+    if (paint_cache_replay(&painter, &con->img.cache, key)) return 0;
+    paint_cache_record_begin(&painter);
     paint_quad(&painter, FRAME_ICRF, &map, 4);
+    paint_cache_record_end(&painter, &con->img.cache, key);
     return 0;
 }
 
@@ -939,6 +967,9 @@ static void constellation_del(obj_t *obj)
     }
     free(con->lines.stars);
     free(con->lines.stars_pos);
+    paint_cache_release(&con->lines.cache);
+    paint_cache_release(&con->img.cache);
+    paint_cache_release(&con->bounds_cache);
 }
 
 static void constellation_get_2d_ellipse(const obj_t *obj,
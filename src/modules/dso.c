@@ -12,12 +12,18 @@
 #include "designation.h"
 #include "utstring.h"
 #include <regex.h>
-#include <zlib.h> // For crc32
 
 // XXX: this very similar to stars.c.  I think we could merge most of the code.
 
 #define DSO_DEFAULT_VMAG 16.0
 
+// Max error allowed on the cached hints window positions (pixels).
+#define HINT_CACHE_MAX_ERR 0.5
+
+// Order of the tiles sub-index cells, relative to the tile order.
+#define CELLS_ORDER 3
+#define CELLS_NB (1 << (2 * CELLS_ORDER))
+
 static obj_klass_t dso_klass;
 
 /*
@@ -57,6 +63,37 @@ typedef struct {
     float  vmag;
 } dso_t;
 
+enum {
+    HINT_CLIPPED    = 1 << 0,
+    HINT_GEOMETRY   = 1 << 1,
+};
+
+/*
+ * Type: dso_hint_t
+ * Cached window space geometry of a DSO hint.
+ *
+ * The values are valid as long as the key matches the current view key.
+ */
+typedef struct {
+    uint32_t    key;
+    int         flags;
+    float       win_pos[2];
+    float       win_size[2];
+    float       win_angle;
+} dso_hint_t;
+
+/*
+ * Type: cell_t
+ * A group of DSOs in a tile, used to skip them all at once when they are
+ * off screen or too faint.
+ */
+typedef struct {
+    double      bounding_cap[4]; // Contains all the DSOs of the cell.
+    float       mag_min;
+    int         start;  // First index in the tile cells_index array.
+    int         nb;
+} cell_t;
+
 /*
  * Type: tile_t
  * Custom tile structure for the dso HiPS survey.
@@ -68,6 +105,12 @@ typedef struct tile {
     int         nb;
     dso_t       *sources;
     dso_clip_data_t *sources_quick;
+    dso_hint_t  *hints; // Allocated at first render.
+    // Sub-index of the sources per HEALPix cells at the tile order plus
+    // CELLS_ORDER.  cells_index contains the sources indices sorted by
+    // cell, then by magnitude.
+    cell_t      cells[CELLS_NB];
+    int         *cells_index;
 } tile_t;
 
 typedef struct survey survey_t;
@@ -95,11 +138,6 @@ typedef struct {
 // Static instance.
 static dsos_t *g_dsos = NULL;
 
-static uint64_t pix_to_nuniq(int order, int pix)
-{
-    return pix + 4 * (1L << (2 * order));
-}
-
 static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
 {
     *order = log2(nuniq / 4) / 2;
@@ -218,6 +256,8 @@ static int del_tile(void *data)
     }
     free(tile->sources);
     free(tile->sources_quick);
+    free(tile->hints);
+    free(tile->cells_index);
     free(tile);
     return 0;
 }
@@ -247,6 +287,68 @@ static void apply_errata(dso_t *s)
     }
 }
 
+/*
+ * Build the tile sub-index of cells.
+ *
+ * Must be called after the sources have been sorted by magnitude.
+ */
+static void tile_compute_cells(tile_t *tile, int order, int pix)
+{
+    int i, c, p, *cells, nside = 1 << (order + CELLS_ORDER);
+    double r, pos[3];
+    const dso_t *s;
+    cell_t *cell;
+
+    cells = calloc(tile->nb, sizeof(*cells));
+    tile->cells_index = calloc(tile->nb, sizeof(*tile->cells_index));
+    for (c = 0; c < CELLS_NB; c++) {
+        tile->cells[c].mag_min = FLT_MAX;
+    }
+
+    // Assign each source to a cell.  The sources that are not inside the
+    // tile (should not happen) all go into the first cell.
+    for (i = 0; i < tile->nb; i++) {
+        s = &tile->sources[i];
+        p = healpix_vec2pix(nside, s->bounding_cap);
+        cells[i] = (p >> (2 * CELLS_ORDER)) == pix ? p % CELLS_NB : 0;
+        cell = &tile->cells[cells[i]];
+        cell->nb++;
+        cell->mag_min = fminf(cell->mag_min, s->display_vmag);
+        vec3_add(cell->bounding_cap, s->bounding_cap, cell->bounding_cap);
+    }
+
+    // Counting sort of the sources by cell.  Since it is stable the
+    // sources stay sorted by magnitude inside each cell.
+    for (c = 1; c < CELLS_NB; c++) {
+        tile->cells[c].start = tile->cells[c - 1].start +
+                               tile->cells[c - 1].nb;
+    }
+    for (c = 0; c < CELLS_NB; c++) {
+        cell = &tile->cells[c];
+        if (cell->nb) {
+            vec3_normalize(cell->bounding_cap, cell->bounding_cap);
+            cell->bounding_cap[3] = 1;
+        }
+        cell->nb = 0;
+    }
+    for (i = 0; i < tile->nb; i++) {
+        cell = &tile->cells[cells[i]];
+        tile->cells_index[cell->start + cell->nb++] = i;
+    }
+
+    // Grow the cells caps to contain all their sources.
+    for (i = 0; i < tile->nb; i++) {
+        s = &tile->sources[i];
+        cell = &tile->cells[cells[i]];
+        vec3_copy(cell->bounding_cap, pos);
+        r = acos(s->bounding_cap[3]);
+        if (isnan(r)) r = 0;
+        r = fmin(vec3_sep(pos, s->bounding_cap) + r, M_PI);
+        cell->bounding_cap[3] = fmin(cell->bounding_cap[3], cos(r));
+    }
+    free(cells);
+}
+
 static int on_file_tile_loaded(const char type[4],
                                const void *data, int size,
                                const json_value *json,
@@ -352,6 +454,7 @@ static int on_file_tile_loaded(const char type[4],
     tile->sources_quick = calloc(tile->nb, sizeof(dso_clip_data_t));
     for (i = 0; i < tile->nb; ++i)
         tile->sources_quick[i] = tile->sources[i].clip_data;
+    tile_compute_cells(tile, order, pix);
 
     // If we have a json header, check for a children mask value.
     if (json) {
@@ -418,6 +521,38 @@ static void compute_hint_transformation(
     win_size[1] = fmax(win_size[1], 12);
 }
 
+static bool is_cap_clipped(const dso_t *s, const painter_t *painter,
+                           uint32_t key, dso_hint_t *cache)
+{
+    if (!cache)
+        return painter_is_cap_clipped(painter, FRAME_ASTROM, s->bounding_cap);
+    if (cache->key != key) {
+        cache->key = key;
+        cache->flags = 0;
+        if (painter_is_cap_clipped(painter, FRAME_ASTROM, s->bounding_cap))
+            cache->flags |= HINT_CLIPPED;
+    }
+    return cache->flags & HINT_CLIPPED;
+}
+
+static void get_hint_transformation(
+        const dso_t *s, const painter_t *painter, dso_hint_t *cache,
+        double win_pos[2], double win_size[2], double *win_angle)
+{
+    if (cache && (cache->flags & HINT_GEOMETRY)) {
+        vec2_set(win_pos, cache->win_pos[0], cache->win_pos[1]);
+        vec2_set(win_size, cache->win_size[0], cache->win_size[1]);
+        *win_angle = cache->win_angle;
+        return;
+    }
+    compute_hint_transformation(painter, s->ra, s->de, s->angle,
+            s->smax, s->smin, s->symbol, win_pos, win_size, win_angle);
+    if (!cache) return;
+    vec2_to_float(win_pos, cache->win_pos);
+    vec2_to_float(win_size, cache->win_size);
+    cache->win_angle = *win_angle;
+    cache->flags |= HINT_GEOMETRY;
+}
 
 static void dso_get_2d_ellipse(const obj_t *obj, const observer_t *obs,
                                const projection_t* proj,
@@ -508,9 +643,45 @@ static void dso_render_label(const dso_t *s,
 }
 
 
-// Render a DSO from its data.
-static int dso_render_from_data(const dso_t *s,
-                                const painter_t *painter, uint64_t hint)
+// Symbols collected during a render, to be painted in a single batch.
+typedef struct {
+    int         nb;
+    int         allocated;
+    symbol_t    *symbols;
+} symbols_batch_t;
+
+static void symbols_batch_add(symbols_batch_t *batch, int symbol,
+                              const double pos[2], const double size[2],
+                              const double color[4], double angle)
+{
+    symbol_t *s;
+    if (batch->nb >= batch->allocated) {
+        batch->allocated = batch->allocated ? batch->allocated * 2 : 256;
+        batch->symbols = realloc(batch->symbols,
+                                 batch->allocated * sizeof(*batch->symbols));
+    }
+    s = &batch->symbols[batch->nb++];
+    s->symbol = symbol;
+    vec2_copy(pos, s->pos);
+    vec2_copy(size, s->size);
+    vec4_copy(color, s->color);
+    s->angle = angle;
+}
+
+/*
+ * Render a DSO from its data.
+ *
+ * Parameters:
+ *   s          - The DSO data.
+ *   painter    - The painter.
+ *   key        - Current view key, as returned by painter_get_view_key.
+ *   cache      - Cached hint geometry of the DSO, or NULL.
+ *   batch      - If set, the symbol is added to the batch instead of being
+ *                painted immediately.
+ */
+static int dso_render_from_data(const dso_t *s, const painter_t *painter,
+                                uint32_t key, dso_hint_t *cache,
+                                symbols_batch_t *batch)
 {
     double color[4];
     double win_pos[2], win_size[2], win_angle, hints_limit_mag;
@@ -528,7 +699,7 @@ static int dso_render_from_data(const dso_t *s,
         return 1;
 
     // Check that it's intersecting with current viewport
-    if (painter_is_cap_clipped(painter, FRAME_ASTROM, s->bounding_cap))
+    if (is_cap_clipped(s, painter, key, cache))
         return 0;
 
     // Special case for Open Clusters, for which the limiting magnitude
@@ -551,9 +722,8 @@ static int dso_render_from_data(const dso_t *s,
     if (vmag > hints_limit_mag + 2)
         return 0;
 
-    compute_hint_transformation(painter, s->ra, s->de, s->angle,
-            s->smax, s->smin, s->symbol, win_pos, win_size,
-            &win_angle);
+    get_hint_transformation(s, painter, cache, win_pos, win_size,
+                            &win_angle);
 
     // Skip if 2D circle is outside screen (TODO intersect 2D ellipse instead)
     if (painter_is_2d_circle_clipped(painter, win_pos,
@@ -591,8 +761,13 @@ static int dso_render_from_data(const dso_t *s,
         if (color[3] > 0.05) {
             if (isnan(s->angle) || s->smin == 0 || s->smin == s->smax)
                 win_angle = 0;
-            symbols_paint(&tmp_painter, s->symbol, win_pos, win_size, color,
-                          win_angle);
+            if (batch) {
+                symbols_batch_add(batch, s->symbol, win_pos, win_size,
+                                  color, win_angle);
+            } else {
+                symbols_paint(&tmp_painter, s->symbol, win_pos, win_size,
+                              color, win_angle);
+            }
         }
     }
 
@@ -606,7 +781,7 @@ static int dso_render_from_data(const dso_t *s,
 static int dso_render(obj_t *obj, const painter_t *painter)
 {
     const dso_t *dso = (const dso_t*)obj;
-    return dso_render_from_data(dso, painter, 0);
+    return dso_render_from_data(dso, painter, 0, NULL, NULL);
 }
 
 void dso_get_designations(
@@ -627,9 +802,11 @@ static int render_visitor(int order, int pix, void *user)
     int *nb_tot = USER_GET(user, 1);
     int *nb_loaded = USER_GET(user, 2);
     survey_t *survey = USER_GET(user, 3);
+    uint32_t key = *(uint32_t*)USER_GET(user, 4);
+    symbols_batch_t *batch = USER_GET(user, 5);
     tile_t *tile;
-    int i, ret, code;
-    uint64_t hint;
+    const cell_t *cell;
+    int i, c, ret, code;
 
     // Early exit if the tile is clipped.
     if (painter_is_healpix_clipped(&painter, FRAME_ICRF, order, pix))
@@ -642,11 +819,24 @@ static int render_visitor(int order, int pix, void *user)
     if (!tile) return 0;
     if (tile->mag_min > painter.stars_limit_mag + 1.5) return 0;
 
-    hint = pix_to_nuniq(order, pix);
-    for (i = 0; i < tile->nb; i++) {
-        ret = dso_render_from_data(&tile->sources[i], &painter, hint);
-        if (ret)
-            break;
+    if (!tile->hints) tile->hints = calloc(tile->nb, sizeof(*tile->hints));
+    for (c = 0; c < CELLS_NB; c++) {
+        cell = &tile->cells[c];
+        if (!cell->nb) continue;
+        // Same test as in dso_render_from_data, for the whole cell.
+        if (cell->mag_min > painter.stars_limit_mag + 1.5 ||
+            cell->mag_min > painter.hard_limit_mag)
+            continue;
+        if (painter_is_cap_clipped(&painter, FRAME_ASTROM,
+                                   cell->bounding_cap))
+            continue;
+        for (i = cell->start; i < cell->start + cell->nb; i++) {
+            ret = dso_render_from_data(
+                    &tile->sources[tile->cells_index[i]], &painter, key,
+                    &tile->hints[tile->cells_index[i]], batch);
+            if (ret)
+                break;
+        }
     }
     if (tile->mag_max > painter.stars_limit_mag + 1.5) return 0;
     return 1;
@@ -664,12 +854,18 @@ static int dsos_render(obj_t *obj, const painter_t *painter_)
     int nb_tot = 0, nb_loaded = 0;
     painter_t painter = *painter_;
     survey_t *survey;
+    uint32_t key = painter_get_view_key(painter_, HINT_CACHE_MAX_ERR);
+    symbols_batch_t batch = {};
 
     painter.color[3] *= dsos->visible.value;
     DL_FOREACH(dsos->surveys, survey) {
-        hips_traverse(USER_PASS(&painter, &nb_tot, &nb_loaded, survey),
+        hips_traverse(USER_PASS(&painter, &nb_tot, &nb_loaded, survey, &key,
+                                &batch),
                       render_visitor);
     }
+    painter.lines.width = 2;
+    symbols_paint_n(&painter, batch.nb, batch.symbols);
+    free(batch.symbols);
     progressbar_report("DSO", "DSO", nb_loaded, nb_tot, -1);
     return 0;
 }
@@ -29,7 +29,7 @@ static int dss_render(obj_t *obj, const painter_t *painter)
     double visibility;
     const dss_t *dss = (const dss_t*)obj;
     painter_t painter2 = *painter;
-    double lum, c, sep, ratio;
+    double lum, c, ratio;
     int render_order, split_order;
 
     if (dss->visible.value == 0.0) return 0;
@@ -67,23 +67,13 @@ static int dss_render(obj_t *obj, const painter_t *painter)
 
     /*
      * Compute split order.
-     * When we are around the poles we need a higher resolution (up to order
-     * 11).  We also limit the split so that we don't split a single quad
-     * too much, or the rendering would be too slow.
-     *
-     * Note 1: this could be done in hips.c, but for the moment we only
-     * need to do this for the DSS survey.
-     * Note 2: instead of this heuristic we should compute the exact healpix
-     * distortion at a given position.
+     * This is only the max value, hips_render only splits the tiles as
+     * much as needed given their actual distortion on screen, which is
+     * higher around the poles.  We limit the split so that we don't split
+     * a single quad too much, or the rendering would be too slow.
      */
-    sep = fmin(vec3_sep(painter->clip_info[FRAME_ICRF].bounding_cap,
-                      VEC(0, 0, +1)),
-               vec3_sep(painter->clip_info[FRAME_ICRF].bounding_cap,
-                      VEC(0, 0, -1)));
-    split_order = mix(12, 4, clamp(sep / (40 * DD2R), 0, 1));
-
     render_order = hips_get_render_order(dss->hips, painter);
-    split_order = fmin(split_order, render_order + 3);
+    split_order = render_order + 3;
 
     hips_render(dss->hips, &painter2, NULL, split_order);
     return 0;
@@ -36,6 +36,8 @@ struct feature {
     int         text_size;
     float       text_rotate;
     float       text_offset[2];
+    int         symbol;         // <SYMBOL_ENUM> value of point features.
+    float       symbol_size;
     bool        hidden;
     bool        blink;
 };
@@ -182,6 +184,13 @@ static void add_geojson_feature(image_t *image,
     feature->text_size = geo_feature->properties.text_size;
     feature->text_rotate = geo_feature->properties.text_rotate;
     vec2_copy(geo_feature->properties.text_offset, feature->text_offset);
+    if (geo_feature->properties.marker_symbol &&
+        geo_feature->geometry.type == GEOJSON_POINT)
+    {
+        feature->symbol = symbols_get_for_otype(
+                geo_feature->properties.marker_symbol);
+        feature->symbol_size = geo_feature->properties.marker_size;
+    }
 
     feature_add_geo(feature, &geo_feature->geometry, feature->stroke_glow);
     DL_APPEND(image->features, feature);
@@ -324,6 +333,8 @@ static int image_render(obj_t *obj, const painter_t *painter_)
     int frame = image->frame, mode;
     const mesh_t *mesh;
     double c[4];
+    symbol_t *symbols = NULL, *symbol;
+    int nb_symbols = 0, allocated = 0;
 
     /*
      * For the moment, we render all the filled shapes first, then
@@ -333,6 +344,7 @@ static int image_render(obj_t *obj, const painter_t *painter_)
      */
     for (feature = image->features; feature; feature = feature->next) {
         if (feature->hidden || feature->fill_color[3] == 0) continue;
+        if (feature->symbol) continue;
         vec4_copy(feature->fill_color, c);
         vec4_emul(c, painter_->color, painter.color);
         if (feature->blink)
@@ -359,6 +371,34 @@ static int image_render(obj_t *obj, const painter_t *painter_)
         }
     }
 
+    // Point symbols, all painted in a single batch.
+    for (feature = image->features; feature; feature = feature->next) {
+        if (feature->hidden || !feature->symbol) continue;
+        if (feature->stroke_color[3] == 0) continue;
+        for (mesh = feature->meshes; mesh; mesh = mesh->next) {
+            if (!painter_project(&painter, frame, mesh->bounding_cap,
+                                 true, false, pos))
+                continue;
+            if (nb_symbols >= allocated) {
+                allocated = allocated ? allocated * 2 : 64;
+                symbols = realloc(symbols, allocated * sizeof(*symbols));
+            }
+            symbol = &symbols[nb_symbols++];
+            symbol->symbol = feature->symbol;
+            vec2_copy(pos, symbol->pos);
+            vec2_set(symbol->size, feature->symbol_size, feature->symbol_size);
+            symbol->angle = 0;
+            vec4_copy(feature->stroke_color, c);
+            vec4_emul(c, painter_->color, symbol->color);
+            if (feature->blink) symbol->color[3] *= blink();
+        }
+    }
+    if (nb_symbols) {
+        painter.lines.width = 1;
+        symbols_paint_n(&painter, nb_symbols, symbols);
+        free(symbols);
+    }
+
     for (feature = image->features; feature; feature = feature->next) {
         if (feature->hidden) continue;
         for (mesh = feature->meshes; mesh; mesh = mesh->next) {
@@ -32,6 +32,7 @@ struct label
     double  priority;     // Priority used in case of positioning conflicts.
                           // Higher value means higher priority.
     double  bounds[4];
+    bool    occulted;     // Set if hidden behind a planet.
 };
 
 typedef struct labels {
@@ -71,6 +72,29 @@ static label_t *label_get(label_t *list, const char *txt, double size,
     return NULL;
 }
 
+/*
+ * Set the label effects, and update the processed text if needed.
+ *
+ * The uppercase conversion is only done when the effect changes, so that
+ * we don't have to do it again at each frame.
+ */
+static void label_set_effects(label_t *label, int effects)
+{
+    int size;
+    bool upper = effects & TEXT_UPPERCASE;
+
+    label->effects = effects;
+    if (upper == (label->render_text != label->text)) return;
+    if (upper) {
+        size = strlen(label->text) + 1;
+        label->render_text = malloc(size);
+        u8_upper(label->render_text, label->text, size);
+    } else {
+        free(label->render_text);
+        label->render_text = label->text;
+    }
+}
+
 static void label_apply_radius_offset(const label_t *label, double win_pos[2])
 {
     double border = label->radius;
@@ -159,15 +183,61 @@ static int labels_init(obj_t *obj, json_value *args)
     return 0;
 }
 
+/*
+ * Test if the 3d labels are hidden behind a planet, querying all of them
+ * at once.
+ */
+static void update_occultations(const painter_t *painter)
+{
+    label_t *label;
+    int i, nb = 0;
+    double (*pos)[3];
+    bool *at_inf, *occulted;
+    const obj_t **ignore;
+
+    DL_FOREACH(g_labels->labels, label) {
+        label->occulted = false;
+        if (label->frame != -1) nb++;
+    }
+    if (!nb) return;
+
+    pos = malloc(nb * sizeof(*pos));
+    at_inf = malloc(nb * sizeof(*at_inf));
+    occulted = malloc(nb * sizeof(*occulted));
+    ignore = malloc(nb * sizeof(*ignore));
+    i = 0;
+    DL_FOREACH(g_labels->labels, label) {
+        if (label->frame == -1) continue;
+        convert_frame(painter->obs, label->frame, FRAME_ICRF, label->at_inf,
+                      label->pos, pos[i]);
+        at_inf[i] = label->at_inf;
+        ignore[i] = label->obj;
+        i++;
+    }
+    core_are_points_occulted(nb, (const void*)pos, at_inf, ignore,
+                             painter->obs, occulted);
+    i = 0;
+    DL_FOREACH(g_labels->labels, label) {
+        if (label->frame == -1) continue;
+        label->occulted = occulted[i++];
+    }
+    free(pos);
+    free(at_inf);
+    free(occulted);
+    free(ignore);
+}
+
 static int labels_render(obj_t *obj, const painter_t *painter_)
 {
     label_t *label;
     double pos[2];
     const double max_overlap = 8;
     painter_t painter = *painter_;
+    int effects;
 
     // Order labels to render them from far to near.
     DL_SORT(g_labels->labels, label_cmp);
+    update_occultations(&painter);
     DL_FOREACH(g_labels->labels, label) {
 
         if (g_labels->hidden_obj && label->obj == g_labels->hidden_obj)
@@ -182,19 +252,16 @@ static int labels_render(obj_t *obj, const painter_t *painter_)
         }
         painter.flags &= ~PAINTER_ENABLE_DEPTH;
         label_apply_radius_offset(label, pos);
+        // The render text is already uppercase.
+        effects = label->effects & ~TEXT_UPPERCASE;
         paint_text_bounds(&painter, label->render_text, pos, label->align,
-                          label->effects, label->size, label->bounds);
+                          effects, label->size, label->bounds);
         label->fader.target = label->active &&
                                 (test_label_overlaps(label) <= max_overlap);
 
-        if (label->frame != -1 &&
-                core_is_point_occulted(label->pos, label->at_inf,
-                                       painter.obs, label->obj)) {
-            label->fader.target = false;
-        }
+        if (label->occulted) label->fader.target = false;
         paint_text(&painter, label->render_text, pos, NULL,
-                   label->align, label->effects, label->size,
-                   label->angle);
+                   label->align, effects, label->size, label->angle);
     }
     return 0;
 }
@@ -255,7 +322,7 @@ void labels_add_3d(const char *text, int frame, const double pos[3],
     vec4_set(label->color, color[0], color[1], color[2], color[3]);
     label->angle = angle;
     label->align = align;
-    label->effects = effects;
+    label_set_effects(label, effects);
     label->priority = priority;
     label->fader.target = true;
     label->active = true;
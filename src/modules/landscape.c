@@ -212,6 +212,7 @@ static landscape_t *add_from_uri(landscapes_t *lss, const char *uri,
         ls->hips = hips_create(uri, 0, NULL);
         hips_set_label(ls->hips, "Landscape");
         hips_set_frame(ls->hips, FRAME_OBSERVED);
+        ls->hips->streaming = true;
         ls->info.name = strdup(key);
     } else {
         // Zero horizon shape.
@@ -164,6 +164,7 @@ struct line {
     const char      *name;
     bool            grid;       // If true render the whole grid.
     double          color[4];
+    paint_cache_t   cache;      // Render items of the previous frames.
 };
 
 static void hex_to_rgba(uint32_t v, double rgba[4])
@@ -680,13 +681,14 @@ static int render_boundary(const painter_t *painter)
 
 static int line_render(obj_t *obj, const painter_t *painter_)
 {
-    const line_t *line = (const line_t*)obj;
+    line_t *line = (line_t*)obj;
     double rot[3][3] = MAT3_IDENTITY;
     const step_t *steps[2];
     int splits[2] = {1, 1};
     int pos[2] = {0, 0};
     bool skip_half = false;
     painter_t painter = *painter_;
+    uint32_t key;
 
     // XXX: probably need to use enum id for the different lines/grids.
     if (strcmp(line->obj.id, "meridian") == 0) {
@@ -698,9 +700,16 @@ static int line_render(obj_t *obj, const painter_t *painter_)
     vec4_copy(line->color, painter.color);
     painter.color[3] *= line->visible.value;
 
+    // Replay the previous frame rendering if nothing changed.
+    key = painter_get_cache_key(&painter, NULL, 0);
+    if (paint_cache_replay(&painter, &line->cache, key)) return 0;
+    paint_cache_record_begin(&painter);
+
     // The boundary line has its own code.
     if (strcmp(line->obj.id, "boundary") == 0) {
-        return render_boundary(&painter);
+        render_boundary(&painter);
+        paint_cache_record_end(&painter, &line->cache, key);
+        return 0;
     }
 
     // Compute the number of divisions of the grid.
@@ -714,9 +723,16 @@ static int line_render(obj_t *obj, const painter_t *painter_)
     }
 
     render_recursion(line, &painter, rot, 0, splits, pos, steps, skip_half);
+    paint_cache_record_end(&painter, &line->cache, key);
     return 0;
 }
 
+static void line_del(obj_t *obj)
+{
+    line_t *line = (line_t*)obj;
+    paint_cache_release(&line->cache);
+}
+
 
 /*
  * Meta class declarations.
@@ -728,6 +744,7 @@ static obj_klass_t line_klass = {
     .flags = OBJ_IN_JSON_TREE,
     .update = line_update,
     .render = line_render,
+    .del = line_del,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(line_t, visible.target)),
         PROPERTY(color, TYPE_V4, MEMBER(line_t, color)),
@@ -13,18 +13,10 @@
 #define MAX_ALTITUDE 120.0          // Max meteor altitude in km
 #define MIN_ALTITUDE 80.0           // Min meteor altitude in km
 
-typedef struct meteor meteor_t;
-
-/*
- * Type: meteor_t
- * Represents a single meteor
- */
-struct meteor {
-    meteor_t    *next, *prev;   // List within the meteors module.
-    double      pvo[2][4];
-    double      duration; // Duration (sec).
-    double      time; // From 0 to duration.
-};
+// Capacity of the meteors pool.
+#define METEORS_MAX_NB 1024
+// Number of segments used to render each meteor trail.
+#define TRAIL_SPLIT 4
 
 typedef struct shower {
     obj_t obj;
@@ -48,7 +40,20 @@ typedef struct shower {
 typedef struct {
     obj_t   obj;
     double  zhr;
-    meteor_t *meteors;
+
+    // Pool of the currently alive meteors, stored as a structure of arrays.
+    // Dead meteors are removed by moving the last one into their slot.
+    struct {
+        int     nb;
+        double  pos[METEORS_MAX_NB][3];     // Head position (ICRF, AU).
+        double  speed[METEORS_MAX_NB][3];   // AU/sec.
+        double  time[METEORS_MAX_NB];       // From 0 to duration (sec).
+        double  duration[METEORS_MAX_NB];   // Duration (sec).
+    } pool;
+
+    // Mesh of all the meteors trails, reused across frames.
+    mesh_t *mesh;
+
     char *showers_url;
     bool showers_loaded;
     bool visible;
@@ -59,60 +64,39 @@ static double frand(double from, double to)
     return from + (rand() / (double)RAND_MAX) * (to - from);
 }
 
-static meteor_t *meteor_create(void)
+static void meteor_create(meteors_t *ms)
 {
     double z, mat[3][3];
-    meteor_t *m = calloc(1, sizeof(*m));
+    int i = ms->pool.nb++;
 
     // Give the meteor a random position and speed.
     z = (EARTH_RADIUS + MAX_ALTITUDE) * 1000 * DM2AU;
     mat3_set_identity(mat);
     mat3_rz(frand(0, 360 * DD2R), mat, mat);
     mat3_ry(frand(-90 * DD2R, +90 * DD2R), mat, mat);
-    mat3_mul_vec3(mat, VEC(1, 0, 0), m->pvo[0]);
-    vec3_mul(z, m->pvo[0], m->pvo[0]);
-    m->pvo[0][3] = 1.0;
+    mat3_mul_vec3(mat, VEC(1, 0, 0), ms->pool.pos[i]);
+    vec3_mul(z, ms->pool.pos[i], ms->pool.pos[i]);
 
-    vec4_set(m->pvo[1], frand(-1, 1), frand(-1, 1), frand(-1, 1), 1);
-    vec3_mul(0.00001, m->pvo[1], m->pvo[1]);
+    vec3_set(ms->pool.speed[i], frand(-1, 1), frand(-1, 1), frand(-1, 1));
+    vec3_mul(0.00001, ms->pool.speed[i], ms->pool.speed[i]);
 
-    m->duration = 4.0;
-    return m;
-}
-
-static int meteor_update(meteor_t *m, double dt)
-{
-    vec3_addk(m->pvo[0], m->pvo[1], dt, m->pvo[0]);
-    m->time += dt;
-    return 0;
+    ms->pool.time[i] = 0;
+    ms->pool.duration[i] = 4.0;
 }
 
 /*
- * Project UV coordinates into a tail shape.
- * For the moment this projects into a triangle.
+ * Add the trail of a meteor into the trails mesh.
+ *
+ * The trail is a thin triangle-like strip starting at the head position
+ * and extending 10° in the direction opposite to the meteor motion.
  */
-static void tail_project(const uv_map_t *map, const double v[2], double out[4])
+static void add_trail(mesh_t *mesh, const double p1[3], const double p2[3],
+                      const uint8_t color[4])
 {
-    double r, p[4] = {1, 0, 0, 0};
-    double m[3][3];
-    r = v[1];
-    r *= 1 - v[0]; // Triangle shape by scaling along U.
-    p[2] = (r - 0.5);
-    mat3_set_identity(m);
-    mat3_rz(v[0] * 10 * DD2R, m, m);
-    mat3_mul_vec3(m, p, p);
-    mat3_mul_vec3(map->mat, p, p);
-
-    p[3] = 1;
-    vec4_copy(p, out);
-}
+    double mat[3][3], a, p[3];
+    int i, ofs = mesh->vertices_count;
+    uint16_t *t;
 
-static void render_tail(const painter_t *painter,
-                        const double p1[4],
-                        const double p2[4])
-{
-    double mat[3][3];
-    uv_map_t map;
     /*
      * Compute the rotation/scale matrix that transforms X into p1 and
      * Y into p1 rotated 90° in the direction of p2.
@@ -124,30 +108,29 @@ static void render_tail(const painter_t *painter,
     vec3_normalize(mat[2], mat[2]);
     vec3_cross(mat[2], mat[0], mat[1]);
 
-    // Scale along Z to specify the tail width.
-    mat3_iscale(mat, 1, 1, 0.001);
-
-    map = (uv_map_t) {
-        .map = tail_project,
-    };
-    mat3_copy(mat, map.mat); // XXX: remove that I guess.
-    paint_quad(painter, FRAME_ICRF, &map, 8);
-}
-
-static int meteor_render(const meteor_t *m, const painter_t *painter_)
-{
-    double p1[4]; // Head position (CIRS)
-    double p2[4]; // End of tail position (CIRS)
-    painter_t painter = *painter_;
-
-    // Very basic fade out.
-    painter.color[3] *= fmax(0.0, 1.0 - m->time / m->duration);
-
-    vec4_copy(m->pvo[0], p1);
-    vec3_addk(p1, m->pvo[1], -2, p2);
-
-    render_tail(&painter, p1, p2);
-    return 0;
+    for (i = 0; i <= TRAIL_SPLIT; i++) {
+        a = (double)i / TRAIL_SPLIT;
+        // Triangle shape, with a width of 0.001 rad at the head.
+        vec3_set(p, cos(a * 10 * DD2R), sin(a * 10 * DD2R), -0.0005);
+        mat3_mul_vec3(mat, p, mesh->vertices[ofs + i * 2 + 0]);
+        vec3_set(p, cos(a * 10 * DD2R), sin(a * 10 * DD2R),
+                 -0.0005 + 0.001 * (1 - a));
+        mat3_mul_vec3(mat, p, mesh->vertices[ofs + i * 2 + 1]);
+        memcpy(mesh->colors[ofs + i * 2 + 0], color, 4);
+        memcpy(mesh->colors[ofs + i * 2 + 1], color, 4);
+    }
+    mesh->vertices_count += (TRAIL_SPLIT + 1) * 2;
+
+    for (i = 0; i < TRAIL_SPLIT; i++) {
+        t = &mesh->triangles[mesh->triangles_count];
+        t[0] = ofs + i * 2 + 0;
+        t[1] = ofs + i * 2 + 1;
+        t[2] = ofs + i * 2 + 2;
+        t[3] = ofs + i * 2 + 1;
+        t[4] = ofs + i * 2 + 3;
+        t[5] = ofs + i * 2 + 2;
+        mesh->triangles_count += 6;
+    }
 }
 
 static int meteors_init(obj_t *obj, json_value *args)
@@ -155,6 +138,13 @@ static int meteors_init(obj_t *obj, json_value *args)
     meteors_t *ms = (meteors_t*)obj;
     ms->visible = true;
     ms->zhr = 10; // Normal rate.
+    ms->mesh = mesh_create();
+    ms->mesh->vertices = calloc(METEORS_MAX_NB * (TRAIL_SPLIT + 1) * 2,
+                                sizeof(*ms->mesh->vertices));
+    ms->mesh->colors = calloc(METEORS_MAX_NB * (TRAIL_SPLIT + 1) * 2,
+                              sizeof(*ms->mesh->colors));
+    ms->mesh->triangles = calloc(METEORS_MAX_NB * TRAIL_SPLIT * 6,
+                                 sizeof(*ms->mesh->triangles));
     return 0;
 }
 
@@ -323,27 +313,32 @@ static json_value *shower_get_json_data(const obj_t *obj)
 static int meteors_update(obj_t *obj, double dt)
 {
     meteors_t *ms = (meteors_t*)obj;
-    meteor_t *m, *tmp;
-    int nb, max_nb = 100;
+    int i, last, nb;
     double proba;
 
     load_showers(ms);
 
-    DL_COUNT(ms->meteors, m, nb);
-    // Probabiliy of having a new shooting star at this frame.
+    // Expected number of new shooting stars at this frame.  At high rate
+    // or large time steps we can spawn several meteors at once.
     proba = ms->zhr * dt / 3600;
+    nb = floor(proba) + (frand(0, 1) < proba - floor(proba) ? 1 : 0);
+    if (nb > METEORS_MAX_NB - ms->pool.nb) nb = METEORS_MAX_NB - ms->pool.nb;
+    for (i = 0; i < nb; i++) meteor_create(ms);
 
-    if (nb < max_nb && frand(0, 1) < proba) {
-        m = meteor_create();
-        DL_APPEND(ms->meteors, m);
+    for (i = 0; i < ms->pool.nb; i++) {
+        vec3_addk(ms->pool.pos[i], ms->pool.speed[i], dt, ms->pool.pos[i]);
+        ms->pool.time[i] += dt;
     }
 
-    DL_FOREACH_SAFE(ms->meteors, m, tmp) {
-        meteor_update(m, dt);
-        if (m->time > m->duration) {
-            DL_DELETE(ms->meteors, m);
-            free(m);
-        }
+    // Remove the dead meteors.
+    for (i = 0; i < ms->pool.nb; i++) {
+        if (ms->pool.time[i] <= ms->pool.duration[i]) continue;
+        last = --ms->pool.nb;
+        vec3_copy(ms->pool.pos[last], ms->pool.pos[i]);
+        vec3_copy(ms->pool.speed[last], ms->pool.speed[i]);
+        ms->pool.time[i] = ms->pool.time[last];
+        ms->pool.duration[i] = ms->pool.duration[last];
+        i--;
     }
 
     return 0;
@@ -351,17 +346,31 @@ static int meteors_update(obj_t *obj, double dt)
 
 static int meteors_render(obj_t *obj, const painter_t *painter)
 {
-    const meteors_t *meteors = (const meteors_t*)obj;
+    const meteors_t *ms = (const meteors_t*)obj;
     obj_t *child;
-    meteor_t *m;
-
-    if (!meteors->visible) return 0;
-
-    DL_FOREACH(meteors->meteors, m) {
-        meteor_render(m, painter);
+    int i;
+    double p2[3];
+    uint8_t color[4] = {255, 255, 255, 255};
+    mesh_t *mesh = ms->mesh;
+
+    if (!ms->visible) return 0;
+
+    // Render all the meteors trails at once.
+    mesh->vertices_count = 0;
+    mesh->triangles_count = 0;
+    for (i = 0; i < ms->pool.nb; i++) {
+        // Very basic fade out.
+        color[3] = 255 * fmax(0.0, 1.0 - ms->pool.time[i] /
+                                        ms->pool.duration[i]);
+        vec3_addk(ms->pool.pos[i], ms->pool.speed[i], -2, p2);
+        add_trail(mesh, ms->pool.pos[i], p2, color);
+    }
+    if (mesh->vertices_count) {
+        mesh_update_bounding_cap(mesh);
+        paint_mesh(painter, FRAME_ICRF, MODE_TRIANGLES, mesh);
     }
 
-    DL_FOREACH(meteors->obj.children, child) {
+    DL_FOREACH(ms->obj.children, child) {
         obj_render(child, painter);
     }
     return 0;
@@ -68,6 +68,7 @@ static int milkyway_add_data_source(
     milkyway_t *mw = (milkyway_t*)obj;
     if (mw->hips) return -1;
     mw->hips = hips_create(url, 0, NULL);
+    mw->hips->streaming = true;
     return 0;
 }
 
@@ -467,30 +467,21 @@ static int mplanets_render(obj_t *obj, const painter_t *painter)
     return 0;
 }
 
-static bool mplanets_is_point_occulted(
-        const obj_t *module, const double pos[3], bool at_inf,
-        const observer_t *obs, const obj_t *ignore)
+static void mplanets_get_occulters(
+        const obj_t *module, const observer_t *obs, void *user,
+        void (*f)(void *user, const obj_t *occulter,
+                  const double pos[3], double radius))
 {
     mplanet_t *child;
     const mplanets_t *mps = (const void*)module;
-    double p[3], d, r, dir[3], t, l2, d2;
+    double r;
 
-    d = vec3_norm(pos);
-    vec3_normalize(pos, dir);
     DL_FOREACH2(mps->visibles, child, visible_next) {
-        if (&child->obj == ignore) continue;
         mplanet_update(child, obs);
-        vec3_copy(child->pvo[0], p);
-        t = vec3_dot(dir, p);
-        if (t < 0) continue;
-        l2 = vec3_norm2(p);
-        if (!at_inf && d * d < l2) continue;
         r = mplanet_get_radius(child);
         if (r == 0) continue;
-        d2 = l2 - t * t;
-        if (d2 < r * r) return true;
+        f(user, &child->obj, child->pvo[0], r);
     }
-    return false;
 }
 
 /*
@@ -517,7 +508,7 @@ static obj_klass_t mplanets_klass = {
     .add_data_source    = mplanets_add_data_source,
     .update         = mplanets_update,
     .render         = mplanets_render,
-    .is_point_occulted = mplanets_is_point_occulted,
+    .get_occulters = mplanets_get_occulters,
     .render_order   = 20,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(mplanets_t, visible)),
@@ -10,10 +10,50 @@
 #include "swe.h"
 
 // Support embedding online photos in the sky.
+//
+// Large photos don't fit in a single texture, so we split them into a
+// pyramid of levels, each level half the size of the previous one, down
+// to a level that fits in a single tile.  We then render each level as
+// a grid of tiles, and only keep the textures of the tiles on screen.
+//
+// We only keep the encoded image in memory.  The pixels of a level are
+// decoded in a thread when some of its visible tiles need to be uploaded,
+// and released as soon as they are all uploaded.
+
+// Size of the tiles of the pyramid levels.
+#define TILE_SIZE 512
+// Delay after which we release the texture of a tile not rendered (sec).
+#define TILE_RELEASE_DELAY 2.0
+
+typedef struct photo_tile {
+    texture_t   *tex;
+    double      last_used; // Unix time of the last render.
+} photo_tile_t;
+
+typedef struct photo_level {
+    uint8_t         *img; // Pixels of the level, only set during uploads.
+    int             w, h;
+    int             nb_w, nb_h; // Number of tiles.
+    photo_tile_t    *tiles;
+    bool            missing; // Set if a tile is waiting for the pixels.
+} photo_level_t;
+
+// Decoding of a photo level, run in a worker.
+typedef struct photo_job photo_job_t;
+struct photo_job {
+    worker_t    worker; // Must be first.
+    photo_job_t *next;  // In the list of detached jobs.
+    const uint8_t *src; // Encoded image data, owned by the photo.
+    int         size;
+    int         level;  // Level to decode, or -1 for the initial decoding.
+    int         nb_levels;
+    uint8_t     *img;
+    int         w, h, bpp;
+};
 
 typedef struct photo {
     obj_t       obj;
-    texture_t   *img;
+    char        *url;
     fader_t     visible;
     // Only render the shape if set.
     // Note: we could have more control, like rendering both the pic and
@@ -30,8 +70,223 @@ typedef struct photo {
     } calibration;
     // Projection uv -> sphere.  Computed from the calibration data.
     double      mat[4][4];
+
+    uint8_t     *src; // Encoded image data.
+    int         size;
+    photo_job_t *job; // Running decoding, if any.
+    bool        error;
+    int         bpp;
+    int         nb_levels;
+    photo_level_t *levels; // From the full resolution to the smallest.
 } photo_t;
 
+// Jobs of released photos that were still running.  We free them once
+// they are done.
+static photo_job_t *g_detached_jobs = NULL;
+
+
+// Reduce an image size by two, using a box filter.  The size is rounded
+// down, like with img_read_from_mem_scaled.
+static uint8_t *img_half(const uint8_t *img, int w, int h, int bpp,
+                         int *out_w, int *out_h)
+{
+    int i, j, k, v;
+    uint8_t *ret;
+    const uint8_t *p;
+
+    *out_w = w / 2;
+    *out_h = h / 2;
+    ret = malloc(*out_w * *out_h * bpp);
+    for (i = 0; i < *out_h; i++)
+    for (j = 0; j < *out_w; j++)
+    for (k = 0; k < bpp; k++) {
+        p = img + (2 * i * w + 2 * j) * bpp + k;
+        v = p[0] + p[bpp] + p[w * bpp] + p[(w + 1) * bpp];
+        ret[(i * *out_w + j) * bpp + k] = v / 4;
+    }
+    return ret;
+}
+
+static int job_worker(worker_t *worker)
+{
+    photo_job_t *job = (void*)worker;
+    uint8_t *img;
+    int i, w, h, shift;
+
+    if (job->level >= 0) {
+        // Only WebP images are decoded at the reduced size, so we reduce
+        // the others ourselves.
+        shift = job->level;
+        job->bpp = 0;
+        job->img = img_read_from_mem_scaled(job->src, job->size, &shift,
+                                            &job->w, &job->h, &job->bpp);
+        for (i = shift; job->img && i < job->level; i++) {
+            img = img_half(job->img, job->w, job->h, job->bpp,
+                           &job->w, &job->h);
+            free(job->img);
+            job->img = img;
+        }
+        return 0;
+    }
+
+    // Initial decoding: compute the number of levels and only keep the
+    // smallest one.
+    job->bpp = 0;
+    job->img = img_read_from_mem(job->src, job->size,
+                                 &job->w, &job->h, &job->bpp);
+    if (!job->img) return 0;
+    job->nb_levels = 1;
+    while ((int)fmax(job->w, job->h) >> (job->nb_levels - 1) > TILE_SIZE &&
+           (int)fmin(job->w, job->h) >> job->nb_levels)
+        job->nb_levels++;
+    w = job->w;
+    h = job->h;
+    for (i = 1; i < job->nb_levels; i++) {
+        img = img_half(job->img, w, h, job->bpp, &w, &h);
+        free(job->img);
+        job->img = img;
+    }
+    return 0;
+}
+
+static void job_delete(photo_job_t *job)
+{
+    free(job->img);
+    free(job);
+}
+
+// Free the detached jobs that are done.
+static void reap_detached_jobs(void)
+{
+    photo_job_t *job, *tmp;
+    LL_FOREACH_SAFE(g_detached_jobs, job, tmp) {
+        if (worker_is_running(&job->worker)) continue;
+        LL_DELETE(g_detached_jobs, job);
+        free((void*)job->src);
+        job_delete(job);
+    }
+}
+
+static void photo_start_job(photo_t *photo, int level)
+{
+    assert(!photo->job);
+    photo->job = calloc(1, sizeof(*photo->job));
+    worker_init(&photo->job->worker, job_worker);
+    photo->job->src = photo->src;
+    photo->job->size = photo->size;
+    photo->job->level = level;
+}
+
+// Create the levels once the initial decoding is done.
+static void photo_init_levels(photo_t *photo, photo_job_t *job)
+{
+    int i;
+    photo_level_t *level;
+
+    photo->bpp = job->bpp;
+    photo->nb_levels = job->nb_levels;
+    photo->levels = calloc(photo->nb_levels, sizeof(*photo->levels));
+    for (i = 0; i < photo->nb_levels; i++) {
+        level = &photo->levels[i];
+        level->w = job->w >> i;
+        level->h = job->h >> i;
+        level->nb_w = (level->w + TILE_SIZE - 1) / TILE_SIZE;
+        level->nb_h = (level->h + TILE_SIZE - 1) / TILE_SIZE;
+        level->tiles = calloc(level->nb_w * level->nb_h,
+                              sizeof(*level->tiles));
+    }
+    level = &photo->levels[photo->nb_levels - 1];
+    level->img = job->img;
+    job->img = NULL;
+}
+
+// Check if the running job is done and get its result.
+static void photo_update_job(photo_t *photo)
+{
+    photo_job_t *job = photo->job;
+    photo_level_t *level;
+
+    if (!job || !worker_iter(&job->worker)) return;
+    photo->job = NULL;
+    if (!job->img) {
+        LOG_W("Cannot decode photo %s", photo->url);
+        photo->error = true;
+    } else if (job->level < 0) {
+        photo_init_levels(photo, job);
+    } else {
+        level = &photo->levels[job->level];
+        assert(job->w == level->w && job->h == level->h &&
+               job->bpp == photo->bpp);
+        assert(!level->img);
+        level->img = job->img;
+        job->img = NULL;
+    }
+    job_delete(job);
+}
+
+/*
+ * Start or continue the loading of the photo.
+ *
+ * Return:
+ *   True if the photo levels are ready.
+ */
+static bool photo_load(photo_t *photo)
+{
+    const void *data;
+    int size, code;
+
+    if (g_detached_jobs) reap_detached_jobs();
+    photo_update_job(photo);
+    if (photo->levels) return true;
+    if (!photo->url || photo->error || photo->job) return false;
+    data = asset_get_data2(photo->url, ASSET_USED_ONCE, &size, &code);
+    if (!code) return false;
+    if (!data) {
+        LOG_W("Cannot load photo %s (%d)", photo->url, code);
+        photo->error = true;
+        return false;
+    }
+    photo->src = malloc(size);
+    photo->size = size;
+    memcpy(photo->src, data, size);
+    photo_start_job(photo, -1);
+    photo_update_job(photo);
+    return photo->levels != NULL;
+}
+
+// Release the levels and stop the loading.
+static void photo_release(photo_t *photo)
+{
+    int i, j;
+    photo_level_t *level;
+
+    // A running job still reads the source data, so we let it finish in
+    // the background and give it the ownership of the data.
+    if (photo->job && worker_is_running(&photo->job->worker)) {
+        LL_PREPEND(g_detached_jobs, photo->job);
+        photo->src = NULL;
+    } else if (photo->job) {
+        job_delete(photo->job);
+    }
+    photo->job = NULL;
+    reap_detached_jobs();
+    free(photo->src);
+    photo->src = NULL;
+    photo->size = 0;
+
+    for (i = 0; i < photo->nb_levels; i++) {
+        level = &photo->levels[i];
+        for (j = 0; j < level->nb_w * level->nb_h; j++)
+            texture_release(level->tiles[j].tex);
+        free(level->tiles);
+        free(level->img);
+    }
+    free(photo->levels);
+    photo->levels = NULL;
+    photo->nb_levels = 0;
+    photo->error = false;
+}
+
 
 static json_value *photo_fn_url(obj_t *obj, const attribute_t *attr,
                                 const json_value *args)
@@ -39,12 +294,14 @@ static json_value *photo_fn_url(obj_t *obj, const attribute_t *attr,
     photo_t *photo = (void*)obj;
     char url[1024];
     if (args->u.array.length) {
-        texture_release(photo->img);
+        photo_release(photo);
         args_get(args, TYPE_STRING, &url);
-        photo->img = texture_from_url(url, 0);
+        free(photo->url);
+        photo->url = strdup(url);
+        photo->mat[3][3] = 0; // Force to recompute the projection.
     }
-    if (!photo->img) return NULL;
-    return args_value_new(TYPE_STRING, photo->img->url);
+    if (!photo->url) return NULL;
+    return args_value_new(TYPE_STRING, photo->url);
 }
 
 static json_value *photo_fn_calibration(obj_t *obj, const attribute_t *attr,
@@ -85,9 +342,129 @@ static void photo_map(const uv_map_t *map, const double v[2], double out[4])
     vec4_copy(p, out);
 }
 
+/*
+ * Get the texture of a tile, or if it is not uploaded yet, of the first
+ * coarser level tile covering it.
+ *
+ * Parameters:
+ *   photo  - A loaded photo.
+ *   lev    - Level of the tile.
+ *   x, y   - Position of the tile in the level grid.
+ *   transf - Set to the transformation from the tile uv to the returned
+ *            texture uv.
+ */
+static texture_t *get_tile_texture(photo_t *photo, int lev, int x, int y,
+                                   double transf[3][3])
+{
+    int k, px, py, w, h;
+    photo_level_t *level = &photo->levels[lev], *parent;
+    photo_tile_t *tile = &level->tiles[y * level->nb_w + x], *ptile;
+
+    px = x * TILE_SIZE;
+    py = y * TILE_SIZE;
+    w = fmin(TILE_SIZE, level->w - px);
+    h = fmin(TILE_SIZE, level->h - py);
+
+    tile->last_used = sys_get_unix_time();
+    if (!tile->tex) {
+        if (level->img && texture_upload_request(w * h * photo->bpp)) {
+            tile->tex = texture_from_data(level->img, level->w, level->h,
+                                          photo->bpp, px, py, w, h, 0);
+        } else {
+            level->missing = true;
+        }
+    }
+    mat3_set_identity(transf);
+    if (tile->tex) return tile->tex;
+
+    // Fallback to the coarser levels.
+    for (k = 1; lev + k < photo->nb_levels; k++) {
+        parent = &photo->levels[lev + k];
+        ptile = &parent->tiles[(y >> k) * parent->nb_w + (x >> k)];
+        if (!ptile->tex) continue;
+        ptile->last_used = tile->last_used;
+        mat3_iscale(transf, (double)w / (1 << k) / ptile->tex->w,
+                            (double)h / (1 << k) / ptile->tex->h, 1.0);
+        mat3_itranslate(transf,
+                (double)(px - (x >> k) * TILE_SIZE * (1 << k)) / w,
+                (double)(py - (y >> k) * TILE_SIZE * (1 << k)) / h);
+        return ptile->tex;
+    }
+    return NULL;
+}
+
+static void render_tiles(photo_t *photo, const painter_t *painter_)
+{
+    painter_t painter = *painter_;
+    photo_level_t *level;
+    texture_t *tex;
+    uv_map_t map = {.map = photo_map};
+    double f, win_h, ratio, u0, v0, tile_mat[4][4], uv[3][3];
+    int lev, x, y, i, j;
+
+    // Pick the first level with a resolution higher than the screen.
+    f = fabs(painter.proj->mat[1][1]);
+    win_h = painter.proj->window_size[1];
+    ratio = 2.0 / (photo->calibration.pixscale * f * win_h);
+    lev = clamp(floor(log2(ratio)), 0, photo->nb_levels - 1);
+
+    for (i = 0; i < photo->nb_levels; i++)
+        photo->levels[i].missing = false;
+    // Make sure the smallest level is always uploaded, since we use it
+    // as a fallback for all the others.
+    get_tile_texture(photo, photo->nb_levels - 1, 0, 0, uv);
+
+    level = &photo->levels[lev];
+
+    map.transf = (void*)tile_mat;
+    for (y = 0; y < level->nb_h; y++)
+    for (x = 0; x < level->nb_w; x++) {
+        u0 = (double)(x * TILE_SIZE) / level->w;
+        v0 = (double)(y * TILE_SIZE) / level->h;
+        mat4_copy(photo->mat, tile_mat);
+        mat4_itranslate(tile_mat, u0, v0, 0);
+        mat4_iscale(tile_mat,
+                    fmin(TILE_SIZE, level->w - x * TILE_SIZE) / level->w,
+                    fmin(TILE_SIZE, level->h - y * TILE_SIZE) / level->h,
+                    1.0);
+        if (painter_is_quad_clipped(&painter, FRAME_ICRF, &map))
+            continue;
+        tex = get_tile_texture(photo, lev, x, y, uv);
+        if (!tex) continue;
+        painter_set_texture(&painter, PAINTER_TEX_COLOR, tex, uv);
+        paint_quad(&painter, FRAME_ICRF, &map, 4);
+    }
+
+    // Only keep the pixels of the levels that still have tiles to upload,
+    // and start the decoding of the ones we need.  We start with the
+    // smallest level, so that we quickly get something on screen.
+    for (i = photo->nb_levels - 1; i >= 0; i--) {
+        level = &photo->levels[i];
+        if (!level->missing) {
+            free(level->img);
+            level->img = NULL;
+        } else if (!level->img && !photo->job) {
+            photo_start_job(photo, i);
+        }
+    }
+
+    // Release the textures not used for a while.  We always keep the
+    // smallest level, so that we have something to render.
+    for (i = 0; i < photo->nb_levels - 1; i++) {
+        level = &photo->levels[i];
+        for (j = 0; j < level->nb_w * level->nb_h; j++) {
+            if (!level->tiles[j].tex) continue;
+            if (sys_get_unix_time() - level->tiles[j].last_used <
+                    TILE_RELEASE_DELAY) continue;
+            texture_release(level->tiles[j].tex);
+            level->tiles[j].tex = NULL;
+        }
+    }
+}
+
 static int photo_render(obj_t *obj, const painter_t *painter)
 {
-     photo_t *photo = (photo_t*)obj;
+    photo_t *photo = (photo_t*)obj;
     typeof(&photo->calibration) calibration = &photo->calibration;
     uv_map_t map = {};
     painter_t painter2 = *painter;
@@ -96,8 +473,8 @@ static int photo_render(obj_t *obj, const painter_t *painter)
     painter2.color[3] *= photo->visible.value;
     if (painter2.color[3] == 0.0) return 0;
 
-    // We can only compute the projection matrix once we get the texture?
-    if (!photo->img || !texture_load(photo->img, NULL)) return 0;
+    // We can only compute the projection matrix once we get the image size.
+    if (!photo_load(photo)) return 0;
 
     if (photo->mat[3][3] == 0) {
         mat4_set_identity(photo->mat);
@@ -105,8 +482,9 @@ static int photo_render(obj_t *obj, const painter_t *painter)
         mat4_ry(90 * DD2R - calibration->dec, photo->mat, photo->mat);
         mat4_rz(-90 * DD2R, photo->mat, photo->mat);
         mat4_rz(calibration->orientation, photo->mat, photo->mat);
-        mat4_iscale(photo->mat, calibration->pixscale * photo->img->w,
-                                calibration->pixscale * photo->img->h, 1.0);
+        mat4_iscale(photo->mat, calibration->pixscale * photo->levels[0].w,
+                                calibration->pixscale * photo->levels[0].h,
+                                1.0);
         mat4_itranslate(photo->mat, -0.5, -0.5, 0.0);
     }
 
@@ -114,8 +492,7 @@ static int photo_render(obj_t *obj, const painter_t *painter)
     map.map = photo_map;
 
     if (!photo->render_shape) {
-        painter_set_texture(&painter2, PAINTER_TEX_COLOR, photo->img, NULL);
-        paint_quad(&painter2, FRAME_ICRF, &map, 4);
+        render_tiles(photo, &painter2);
     } else {
         paint_quad_contour(&painter2, FRAME_ICRF, &map, 8, 15);
         painter2.color[3] *= 0.25;
@@ -125,6 +502,13 @@ static int photo_render(obj_t *obj, const painter_t *painter)
     return 0;
 }
 
+static void photo_del(obj_t *obj)
+{
+    photo_t *photo = (photo_t*)obj;
+    photo_release(photo);
+    free(photo->url);
+}
+
 /*
  * Meta class declarations.
  */
@@ -133,6 +517,7 @@ static obj_klass_t photo_klass = {
     .id         = "photo",
     .size       = sizeof(photo_t),
     .render     = photo_render,
+    .del        = photo_del,
     .attributes = (attribute_t[]) {
         PROPERTY(visible, TYPE_BOOL, MEMBER(photo_t, visible.target)),
         PROPERTY(url, TYPE_STRING_PTR, .fn = photo_fn_url),
@@ -1145,30 +1145,21 @@ static bool should_render_label(
 }
 
 /*
- * Test if a point in ICRF coordinates is occulted by any planet.
+ * List all the planets as occulters.
  * This is used by the labels module to hide labels.
  */
-static bool planets_is_point_occulted(
-        const obj_t *module, const double pos[3], bool at_inf,
-        const observer_t *obs, const obj_t *ignore)
+static void planets_get_occulters(
+        const obj_t *module, const observer_t *obs, void *user,
+        void (*f)(void *user, const obj_t *occulter,
+                  const double pos[3], double radius))
 {
     const planet_t *p;
-    double pvo[2][3], d, r, dir[3], t, l2, d2;
-    d = vec3_norm(pos);
-    vec3_normalize(pos, dir);
+    double pvo[2][3];
     PLANETS_ITER(g_planets, p) {
         if (!obs->space && p->id == EARTH) continue;
-        if (&p->obj == ignore) continue;
         planet_get_pvo(p, obs, pvo);
-        t = vec3_dot(dir, pvo[0]);
-        if (t < 0) continue;
-        l2 = vec3_norm2(pvo[0]);
-        if (!at_inf && d * d < l2) continue;
-        d2 = l2 - t * t;
-        r = p->radius_m * DM2AU;
-        if (d2 < r * r) return true;
+        f(user, &p->obj, pvo[0], p->radius_m * DM2AU);
     }
-    return false;
 }
 
 static void planet_render(const planet_t *planet, const painter_t *painter_)
@@ -1621,7 +1612,7 @@ static obj_klass_t planets_klass = {
     .update = planets_update,
     .render = planets_render,
     .list   = planets_list,
-    .is_point_occulted = planets_is_point_occulted,
+    .get_occulters = planets_get_occulters,
     .add_data_source = planets_add_data_source,
     .render_order = 30,
     .attributes = (attribute_t[]) {
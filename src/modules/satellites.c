@@ -12,10 +12,42 @@
 #include "designation.h"
 
 #define SATELLITE_DEFAULT_MAG 7.0
+
+// Margin used by the visibility prefilter, to account for the refraction
+// and the approximations we make.
+#define PREFILTER_MARGIN (2.0 * DD2R)
+// Max duration we keep a prefilter result for hidden satellites (days).
+#define PREFILTER_MAX_DURATION (1.0 / 24)
+// Duration after which we recheck the prefilter of satellites that might
+// be visible (days).
+#define PREFILTER_CANDIDATE_DURATION (60.0 / ERFA_DAYSEC)
+
+// Pass prediction coarse search step and refine precision (days).
+#define PASS_STEP (30.0 / ERFA_DAYSEC)
+#define PASS_PRECISION (1.0 / ERFA_DAYSEC)
+// Number of samples used to find the peak magnitude of a pass.
+#define PASS_VMAG_SAMPLES 16
+// Max time range for the passes prediction (days).
+#define PASS_MAX_RANGE 30.0
 /*
  * Artificial satellites module
  */
 
+/*
+ * Type: prefilter_t
+ * Result of the satellite visibility prefilter.
+ *
+ * If hidden is set, the satellite is guaranteed to be below the horizon
+ * for any utc time within duration days of time, as long as the observer
+ * location hash doesn't change.
+ */
+typedef struct prefilter {
+    uint64_t    obs_hash;
+    double      time;
+    double      duration;
+    bool        hidden;
+} prefilter_t;
+
 /*
  * Type: satellite_t
  * Represents an individual satellite.
@@ -37,12 +69,31 @@ struct satellite {
 
     bool error; // Set if we got an error computing the position.
     json_value *data; // Data passed in the constructor.
+    // Original jsonl line, only parsed into 'data' when needed.
+    char *json_line;
+    // Designations, each null terminated, ending with an empty string.
+    char *names;
     double max_brightness; // Cached max_brightness value.
 
+    prefilter_t prefilter; // Cached visibility prefilter result.
+
     // Linked list of currently visible on screen.
     satellite_t *visible_next, *visible_prev;
 };
 
+/*
+ * Type: passes_job_t
+ * A compute_passes call, whose tasks are run from the module update.
+ */
+typedef struct passes_job passes_job_t;
+struct passes_job {
+    passes_job_t        *next, *prev;
+    int                 id;
+    int                 nb;
+    struct pass_task    *tasks;
+    bool                done;
+};
+
 // Module class.
 typedef struct satellites {
     obj_t   obj;
@@ -55,6 +106,9 @@ typedef struct satellites {
 
     satellite_t *render_current;
     satellite_t *visibles; // Linked list of currently visible satellites.
+
+    passes_job_t *passes_jobs; // Running or finished compute_passes calls.
+    int         passes_last_id;
 } satellites_t;
 
 // Static instance.
@@ -85,44 +139,291 @@ static int satellites_add_data_source(
     return 0;
 }
 
-static int load_jsonl_data(satellites_t *sats, const char *data, int size,
-                           const char *url, double *last_epoch)
+/*
+ * Type: sat_record_t
+ * Satellite values directly extracted from a jsonl line.
+ */
+typedef struct sat_record {
+    int     number;
+    double  stdmag;
+    char    type[4];
+    char    tle[2][80];
+    char    launch_date[16];
+    char    decay_date[16];
+    int     names_size;
+    char    names[1024];
+} sat_record_t;
+
+static void js_skip_ws(const char **p)
 {
-    const char *line = NULL;
-    int len, line_idx = 0, nb = 0;
-    char *uncompressed_data;
-    json_value *json;
-    satellite_t *sat;
+    while (**p == ' ' || **p == '\t' || **p == '\r' || **p == '\n') (*p)++;
+}
 
-    // XXX: should use a more robust gz uncompression function for external
-    // data.
-    uncompressed_data = z_uncompress_gz(data, size, &size);
-    if (!uncompressed_data) {
-        LOG_E("Cannot uncompress gz file: %s", url);
-        return -1;
+// Encode a unicode code point in utf8.  Return the number of bytes.
+static int utf8_encode(unsigned int code, char *out)
+{
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = 0xC0 | (code >> 6);
+        out[1] = 0x80 | (code & 0x3F);
+        return 2;
     }
+    out[0] = 0xE0 | (code >> 12);
+    out[1] = 0x80 | ((code >> 6) & 0x3F);
+    out[2] = 0x80 | (code & 0x3F);
+    return 3;
+}
 
-    data = uncompressed_data;
+/*
+ * Parse a json string and move the pointer after it.  If out is NULL the
+ * string is just skipped.  Too long strings get truncated.
+ */
+static int js_parse_str(const char **p, char *out, int size)
+{
+    const char *s = *p;
+    unsigned int code;
+    int n = 0;
+    char c, buf[4];
+
+    if (*s++ != '"') return -1;
+    while (*s != '"') {
+        c = *s++;
+        if (!c) return -1;
+        if (c == '\\') {
+            c = *s++;
+            switch (c) {
+            case '\0': return -1;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                if (sscanf(s, "%4x", &code) != 1) return -1;
+                s += 4;
+                code = utf8_encode(code, buf);
+                if (out && n + code < size) {
+                    memcpy(out + n, buf, code);
+                    n += code;
+                }
+                continue;
+            }
+        }
+        if (out && n < size - 1) out[n++] = c;
+    }
+    if (out) out[n] = '\0';
+    *p = s + 1;
+    return 0;
+}
 
-    *last_epoch = 0;
-    while (iter_lines(data, size, &line, &len)) {
-        line_idx++;
-        json = json_parse(line, len);
-        if (!json) goto error;
-        sat = (void*)module_add_new(&sats->obj, "tle_satellite", json);
-        json_value_free(json);
-        if (!sat) goto error;
-        *last_epoch = fmax(*last_epoch, sgp4_get_satepoch(sat->elsetrec));
-        nb++;
-        continue;
-error:
-        LOG_E("Cannot create sat from %s:%d", url, line_idx);
+// Skip a json value of any type.
+static int js_skip_value(const char **p)
+{
+    int depth = 0;
+    if (**p != '{' && **p != '[' && **p != '"') {
+        // Number or literal.
+        *p += strcspn(*p, ",}] \t\r\n");
+        return 0;
+    }
+    while (true) {
+        switch (**p) {
+        case '\0':
+            return -1;
+        case '"':
+            if (js_parse_str(p, NULL, 0)) return -1;
+            if (depth == 0) return 0;
+            continue;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (--depth == 0) {
+                (*p)++;
+                return 0;
+            }
+            break;
+        }
+        (*p)++;
+    }
+}
+
+/*
+ * Iter the elements of a json object or array.
+ *
+ * Should be called first with the pointer on the opening character, then
+ * after each element value has been parsed.
+ *
+ * Return:
+ *   1 if there is a new element (the pointer is then set to it), 0 at the
+ *   end of the object or array, -1 in case of error.
+ */
+static int js_iter(const char **p, char open, char close)
+{
+    js_skip_ws(p);
+    if (**p != open && **p != ',' && **p != close) return -1;
+    if (*(*p)++ == close) return 0;
+    js_skip_ws(p);
+    if (**p == close) {
+        (*p)++;
+        return 0;
+    }
+    return 1;
+}
+
+// Parse an object member key, and move the pointer to its value.
+static int js_parse_key(const char **p, char *key, int size)
+{
+    if (js_parse_str(p, key, size)) return -1;
+    js_skip_ws(p);
+    if (*(*p)++ != ':') return -1;
+    js_skip_ws(p);
+    return 0;
+}
+
+static int parse_record_model_data(const char **p, sat_record_t *rec)
+{
+    char key[32];
+    char *end;
+    int r, i = 0;
+
+    while ((r = js_iter(p, '{', '}')) == 1) {
+        if (js_parse_key(p, key, sizeof(key))) return -1;
+        if (strcmp(key, "norad_number") == 0) {
+            rec->number = strtol(*p, &end, 10);
+            *p = end;
+        } else if (strcmp(key, "mag") == 0 && **p != 'n') {
+            rec->stdmag = strtod(*p, &end);
+            *p = end;
+        } else if (strcmp(key, "tle") == 0 && **p == '[') {
+            while ((r = js_iter(p, '[', ']')) == 1) {
+                if (i >= 2) return -1;
+                if (js_parse_str(p, rec->tle[i++], sizeof(rec->tle[0])))
+                    return -1;
+            }
+            if (r < 0 || i != 2) return -1;
+        } else if (strcmp(key, "launch_date") == 0 && **p == '"') {
+            if (js_parse_str(p, rec->launch_date, sizeof(rec->launch_date)))
+                return -1;
+        } else if (strcmp(key, "decay_date") == 0 && **p == '"') {
+            if (js_parse_str(p, rec->decay_date, sizeof(rec->decay_date)))
+                return -1;
+        } else {
+            if (js_skip_value(p)) return -1;
+        }
+    }
+    return (r < 0 || i != 2) ? -1 : 0;
+}
+
+/*
+ * Extract the values we need from a jsonl satellite line, without creating
+ * an intermediate json tree.
+ *
+ * The line has the same format as the json passed to satellite_init.
+ */
+static int parse_record(const char *line, sat_record_t *rec)
+{
+    const char *p = line;
+    char key[32], str[128];
+    char *names = rec->names;
+    int r, r2, size;
+    bool has_type = false, has_model_data = false;
+
+    memset(rec, 0, offsetof(sat_record_t, names));
+    rec->stdmag = SATELLITE_DEFAULT_MAG;
+    memcpy(rec->type, "Asa", 4);
+
+    while ((r = js_iter(&p, '{', '}')) == 1) {
+        if (js_parse_key(&p, key, sizeof(key))) return -1;
+        if (strcmp(key, "model_data") == 0 && *p == '{') {
+            if (parse_record_model_data(&p, rec)) return -1;
+            has_model_data = true;
+        } else if (strcmp(key, "types") == 0 && *p == '[') {
+            // Use the first type that is a kind of artificial satellite.
+            while ((r2 = js_iter(&p, '[', ']')) == 1) {
+                if (js_parse_str(&p, str, sizeof(str))) return -1;
+                if (has_type || !otype_match(str, "Asa")) continue;
+                strncpy(rec->type, str, 4);
+                has_type = true;
+            }
+            if (r2 < 0) return -1;
+        } else if (strcmp(key, "names") == 0 && *p == '[') {
+            while ((r2 = js_iter(&p, '[', ']')) == 1) {
+                size = sizeof(rec->names) - 1 - (names - rec->names);
+                if (js_parse_str(&p, size > 1 ? names : NULL, size))
+                    return -1;
+                if (size > 1) names += strlen(names) + 1;
+            }
+            if (r2 < 0) return -1;
+        } else {
+            if (js_skip_value(&p)) return -1;
+        }
     }
+    *names++ = '\0';
+    rec->names_size = names - rec->names;
+    return (r < 0 || !has_model_data) ? -1 : 0;
+}
+
+static void satellite_setup(satellite_t *sat, const char *tle1,
+                            const char *tle2, const char *launch_date,
+                            const char *decay_date);
+
+typedef struct {
+    satellites_t    *sats;
+    const char      *url;
+    int             line_idx;
+    int             nb;
+    double          last_epoch;
+} load_ctx_t;
+
+static int on_jsonl_line(void *user, const char *line, int len)
+{
+    load_ctx_t *ctx = user;
+    sat_record_t rec;
+    satellite_t *sat;
 
-    free(uncompressed_data);
-    return nb;
+    ctx->line_idx++;
+    if (parse_record(line, &rec)) {
+        LOG_E("Cannot create sat from %s:%d", ctx->url, ctx->line_idx);
+        return 0;
+    }
+    sat = (void*)module_add_new(&ctx->sats->obj, "tle_satellite", NULL);
+    sat->number = rec.number;
+    sat->stdmag = rec.stdmag;
+    memcpy(sat->obj.type, rec.type, 4);
+    sat->names = malloc(rec.names_size);
+    memcpy(sat->names, rec.names, rec.names_size);
+    sat->json_line = strndup(line, len);
+    satellite_setup(sat, rec.tle[0], rec.tle[1],
+                    *rec.launch_date ? rec.launch_date : NULL,
+                    *rec.decay_date ? rec.decay_date : NULL);
+    ctx->last_epoch = fmax(ctx->last_epoch,
+                           sgp4_get_satepoch(sat->elsetrec));
+    ctx->nb++;
+    return 0;
 }
 
+static int load_jsonl_data(satellites_t *sats, const char *data, int size,
+                           const char *url, double *last_epoch)
+{
+    load_ctx_t ctx = {.sats = sats, .url = url};
+
+    // Iter the lines as we uncompress the data, so that we never have to
+    // keep the full uncompressed file in memory.
+    if (z_uncompress_gz_lines(data, size, &ctx, on_jsonl_line)) {
+        LOG_E("Cannot uncompress gz file: %s", url);
+        return -1;
+    }
+    *last_epoch = ctx.last_epoch;
+    return ctx.nb;
+}
+
+static void satellites_update_passes(satellites_t *sats);
+
 static int satellites_update(obj_t *obj, double dt)
 {
     satellites_t *sats = (satellites_t*)obj;
@@ -131,6 +432,7 @@ static int satellites_update(obj_t *obj, double dt)
     int size, code, nb;
     char buf[128];
 
+    satellites_update_passes(sats);
     if (sats->loaded) return 0;
     if (!sats->jsonl_url) return 0;
 
@@ -153,12 +455,13 @@ static void add_to_visible(satellites_t *sats, satellite_t *sat)
 }
 
 static int satellite_render(obj_t *obj, const painter_t *painter);
+static bool satellite_is_hidden(satellite_t *sat, const observer_t *obs);
 
 static int satellites_render(obj_t *obj, const painter_t *painter)
 {
     satellites_t *sats = (void*)obj;
-    int i, r;
-    const int update_nb = 32;
+    int i, j, r;
+    const int update_nb = 32, max_iter = 1024;
     satellite_t *child, *tmp;
 
     if (!sats->visible) return false;
@@ -179,11 +482,19 @@ static int satellites_render(obj_t *obj, const painter_t *painter)
         }
     }
 
-    // Then iter part of the full list as well.
-    for (   i = 0, child = sats->render_current ?: (void*)sats->obj.children;
-            child && i < update_nb;
-            i++, child = (void*)child->obj.next) {
+    // Then iter part of the full list as well.  When the ground hides the
+    // sky below the horizon, satellites that the prefilter knows are below
+    // the horizon are cheap to skip, so they don't count in the number of
+    // satellites updated per frame.
+    for (   i = 0, j = 0,
+            child = sats->render_current ?: (void*)sats->obj.children;
+            child && i < update_nb && j < max_iter;
+            j++, child = (void*)child->obj.next) {
         if (child->visible_prev) continue; // Was already rendered.
+        if ((painter->flags & PAINTER_HIDE_BELOW_HORIZON) &&
+                satellite_is_hidden(child, painter->obs))
+            continue;
+        i++;
         r = satellite_render(&child->obj, painter);
         if (r == 1) add_to_visible(sats, child);
     }
@@ -308,15 +619,64 @@ error:
     return -1;
 }
 
+/*
+ * Set the satellite orbit elements and the values that depend on them.
+ *
+ * The satellite number, stdmag and names should already be set.
+ */
+static void satellite_setup(satellite_t *sat, const char *tle1,
+                            const char *tle2, const char *launch_date,
+                            const char *decay_date)
+{
+    double startmfe, stopmfe, deltamin;
+    const char *name = sat->names;
+
+    sat->elsetrec = sgp4_twoline2rv(tle1, tle2, 'c', 'm', 'i',
+                                    &startmfe, &stopmfe, &deltamin);
+    sat->max_brightness = compute_max_brightness(sat->elsetrec, sat->stdmag);
+
+    if (launch_date) parse_date(launch_date, &sat->launch_date);
+    if (decay_date) parse_date(decay_date, &sat->decay_date);
+
+    // Determin what 3d model to use.
+    if (name && strncmp(name, "NAME STARLINK", 13) == 0)
+        sat->model = "Starlink";
+    if (sat->number == 25544) sat->model = "ISS";
+    if (sat->number == 20580) sat->model = "HST";
+}
+
+/*
+ * Create the list of null terminated names from a json array of strings.
+ */
+static char *names_from_json(const json_value *val)
+{
+    int i, size = 1;
+    char *ret, *p;
+    const json_value *v;
+
+    if (!val || val->type != json_array) return NULL;
+    for (i = 0; i < val->u.array.length; i++) {
+        v = val->u.array.values[i];
+        if (v->type != json_string) return NULL;
+        size += v->u.string.length + 1;
+    }
+    p = ret = malloc(size);
+    for (i = 0; i < val->u.array.length; i++) {
+        v = val->u.array.values[i];
+        memcpy(p, v->u.string.ptr, v->u.string.length + 1);
+        p += v->u.string.length + 1;
+    }
+    *p = '\0';
+    return ret;
+}
+
 static int satellite_init(obj_t *obj, json_value *args)
 {
     // Support creating a satellite using noctuasky model data json values.
     satellite_t *sat = (satellite_t*)obj;
-    const char *tle1, *tle2, *name = NULL,
-               *launch_date = NULL, *decay_date = NULL;
-    double startmfe, stopmfe, deltamin;
+    const char *tle1, *tle2, *launch_date = NULL, *decay_date = NULL;
     int r;
-    const json_value *types = NULL;
+    const json_value *types = NULL, *names = NULL;
 
     sat->vmag = SATELLITE_DEFAULT_MAG;
     sat->stdmag = SATELLITE_DEFAULT_MAG;
@@ -331,29 +691,17 @@ static int satellite_init(obj_t *obj, json_value *args)
                 "?launch_date", JCON_STR(launch_date),
                 "?decay_date", JCON_STR(decay_date),
             "}",
-            "?names", "[", JCON_STR(name), "]",
+            "?names", JCON_VAL(names),
         "}");
         if (r) {
             LOG_E("Cannot parse satellite json data");
             assert(false);
             return -1;
         }
-        sat->elsetrec = sgp4_twoline2rv(tle1, tle2, 'c', 'm', 'i',
-                                        &startmfe, &stopmfe, &deltamin);
         strncpy(sat->obj.type, otype_from_json(types, "Asa"), 4);
-
         sat->data = json_copy(args);
-        sat->max_brightness = compute_max_brightness(
-                sat->elsetrec, sat->stdmag);
-
-        if (launch_date) parse_date(launch_date, &sat->launch_date);
-        if (decay_date) parse_date(decay_date, &sat->decay_date);
-
-        // Determin what 3d model to use.
-        if (name && strncmp(name, "NAME STARLINK", 13) == 0)
-            sat->model = "Starlink";
-        if (sat->number == 25544) sat->model = "ISS";
-        if (sat->number == 20580) sat->model = "HST";
+        sat->names = names_from_json(names);
+        satellite_setup(sat, tle1, tle2, launch_date, decay_date);
     }
 
     return 0;
@@ -363,6 +711,8 @@ static void satellite_del(obj_t *obj)
 {
     satellite_t *sat = (satellite_t*)obj;
     free(sat->elsetrec);
+    free(sat->json_line);
+    free(sat->names);
     json_builder_free(sat->data);
 }
 
@@ -431,6 +781,68 @@ static int satellite_update(satellite_t *sat, const observer_t *obs)
     return 0;
 }
 
+/*
+ * Compute the visibility prefilter of a satellite.
+ *
+ * This uses a coarse test from the satellite orbit: the satellite is above
+ * the horizon only if its geocentric angle to the observer is smaller than
+ * acos(R / r), with R the observer distance to the earth center and r the
+ * satellite distance, that is never more than the apogee.  Since we know
+ * the maximum angular speed of the satellite (at perigee) and of the
+ * observer (earth rotation), we can compute how long the satellite will
+ * stay below the horizon at least.
+ */
+static void compute_prefilter(const satellite_t *sat, const observer_t *obs,
+                              prefilter_t *out)
+{
+    const double MU = 398600.4418; // Earth gravitational param (km^3/s^2).
+    const double EARTH_ROT = 7.2921159e-5; // Earth rotation speed (rad/s).
+    double r[3], v[3], h[3], obs_pos[3], a, e, rp, ra, lambda, sep, w;
+
+    out->obs_hash = obs->hash_partial;
+    out->time = obs->utc;
+    out->duration = PREFILTER_CANDIDATE_DURATION;
+    out->hidden = false;
+
+    if (obs->space || sat->error) return;
+    if (sgp4(sat->elsetrec, obs->utc, r, v) != 0) return;
+
+    // Orbit shape from the position and speed (km, km/s).
+    vec3_cross(r, v, h);
+    a = 2 / vec3_norm(r) - vec3_norm2(v) / MU;
+    if (a <= 0) return; // Not a closed orbit.
+    a = 1 / a;
+    e = sqrt(fmax(0, 1 - vec3_norm2(h) / (MU * a)));
+    rp = a * (1 - e);
+    ra = a * (1 + e);
+
+    // Observer position in the same frame, ignoring the equation of the
+    // equinoxes.
+    eraGd2gc(1, obs->elong, obs->phi, obs->hm, obs_pos);
+    vec3_mul(0.001, obs_pos, obs_pos);
+    vec2_rotate(eraEra00(DJM0, obs->ut1), obs_pos, obs_pos);
+    if (vec3_norm(obs_pos) >= ra) return;
+
+    lambda = acos(vec3_norm(obs_pos) / ra);
+    sep = vec3_sep(obs_pos, r) - lambda - PREFILTER_MARGIN;
+    if (sep <= 0) return;
+    w = vec3_norm(h) / (rp * rp) + EARTH_ROT;
+    out->hidden = true;
+    out->duration = fmin(sep / w / ERFA_DAYSEC, PREFILTER_MAX_DURATION);
+}
+
+/*
+ * Check if the satellite is guaranteed to be below the horizon, only
+ * updating the prefilter when its result expired.
+ */
+static bool satellite_is_hidden(satellite_t *sat, const observer_t *obs)
+{
+    if (sat->prefilter.obs_hash != obs->hash_partial ||
+            fabs(obs->utc - sat->prefilter.time) > sat->prefilter.duration)
+        compute_prefilter(sat, obs, &sat->prefilter);
+    return sat->prefilter.hidden;
+}
+
 /*
  * Compute the rotation from ICRF to Local Vertical Local Horizontal
  * for 3d models rendering.
@@ -507,8 +919,15 @@ static int satellite_get_info(const obj_t *obj, const observer_t *obs, int info,
 
 static json_value *satellite_get_json_data(const obj_t *obj)
 {
-    const satellite_t *sat = (const satellite_t*)obj;
-    json_value *ret;
+    satellite_t *sat = (satellite_t*)obj;
+    json_value *ret, *json;
+
+    // Satellites loaded from jsonl data only parse the full json on demand.
+    if (!sat->data && sat->json_line) {
+        json = json_parse(sat->json_line, strlen(sat->json_line));
+        if (json) sat->data = json_copy(json);
+        json_value_free(json);
+    }
     ret = sat->data ? json_copy(sat->data) : json_object_new(0);
     if (painter_3d_model_exists(sat->model))
         json_object_push(ret, "can_orbit", json_boolean_new(true));
@@ -526,21 +945,15 @@ static json_value *satellite_get_json_data(const obj_t *obj)
 static bool satellite_get_short_name(const satellite_t *sat, bool selected,
                                      char *out, int size)
 {
-    int i;
-    json_value *jnames;
     const char* name;
     char buf[256];
     int len, best_name_len = size;
 
     *out = '\0';
-    if (!sat->data) return false;
-    jnames = json_get_attr(sat->data, "names", json_array);
-    if (!jnames || jnames->u.array.length == 0) return false;
+    if (!sat->names || !*sat->names) return false;
     if (selected) goto use_first_dsgn;
 
-    for (i = 0; i < jnames->u.array.length; ++i) {
-        if (jnames->u.array.values[i]->type != json_string) continue;
-        name = jnames->u.array.values[i]->u.string.ptr;
+    for (name = sat->names; *name; name += strlen(name) + 1) {
         if (strncmp(name, "NAME ", 5) != 0) continue;
         designation_cleanup(name, buf, sizeof(buf), DSGN_TRANSLATE);
         len = strlen(buf);
@@ -553,9 +966,7 @@ static bool satellite_get_short_name(const satellite_t *sat, bool selected,
     if (*out) return true;
 
 use_first_dsgn:
-    if (jnames->u.array.values[0]->type != json_string) return false;
-    name = jnames->u.array.values[0]->u.string.ptr;
-    designation_cleanup(name, out, size, DSGN_TRANSLATE);
+    designation_cleanup(sat->names, out, size, DSGN_TRANSLATE);
     return true;
 }
 
@@ -628,6 +1039,10 @@ static int satellite_render(obj_t *obj, const painter_t *painter_)
     const double hints_limit_mag = painter.hints_limit_mag +
                                    g_satellites->hints_mag_offset - 2.5;
 
+    // The prefilter only tells us that the satellite is below the horizon.
+    if (!selected && (painter.flags & PAINTER_HIDE_BELOW_HORIZON) &&
+            satellite_is_hidden(sat, painter.obs))
+        return 0;
     satellite_update(sat, painter.obs);
     vmag = sat->vmag;
     if (sat->error || !satellite_is_operational(sat, painter.obs->utc))
@@ -695,19 +1110,12 @@ static void satellite_get_designations(
              const char *cat, const char *str))
 {
     const satellite_t *sat = (const satellite_t*)obj;
-    json_value *names;
-    char *name;
-    int i;
+    const char *name;
     char buf[32];
 
-    if (!sat->data) goto fallback;
-    names = json_get_attr(sat->data, "names", json_array);
-    if (!names || names->u.array.length == 0) goto fallback;
-    for (i = 0; i < names->u.array.length; i++) {
-        if (names->u.array.values[i]->type != json_string) goto fallback;
-        name = names->u.array.values[i]->u.string.ptr;
+    if (!sat->names || !*sat->names) goto fallback;
+    for (name = sat->names; *name; name += strlen(name) + 1)
         f(obj, user, NULL, name);
-    }
     return;
 
 fallback:
@@ -767,6 +1175,349 @@ int satellite_get_altitude(const obj_t *obj, const observer_t *obs,
     return 0;
 }
 
+/*
+ * Type: sat_pass_t
+ * A satellite pass above the observer horizon.
+ */
+typedef struct sat_pass {
+    double rise;        // UTC MJD.
+    double culmination; // UTC MJD.
+    double set;         // UTC MJD.
+    double max_alt;     // Altitude at culmination (rad).
+    double vmag;        // Peak (brightest) magnitude during the pass.
+} sat_pass_t;
+
+/*
+ * Type: pass_task_t
+ * Passes prediction of a single satellite, run in a worker.
+ */
+typedef struct pass_task {
+    worker_t    worker; // Must be first.
+    satellite_t sat;    // Copy of the satellite, owned by the task.
+    observer_t  obs;
+    double      start;
+    double      end;
+    double      min_alt;
+    bool        done;
+    int         nb;
+    sat_pass_t  *passes;
+} pass_task_t;
+
+static int pass_task_worker(worker_t *worker);
+
+/*
+ * Init a passes task for a satellite.
+ *
+ * The task works on its own copy of the satellite, so that it doesn't
+ * change the rendered satellite, and it doesn't keep any pointer to the
+ * satellite data, that can be deleted while the task runs.
+ */
+static void pass_task_init(pass_task_t *task, const satellite_t *sat)
+{
+    worker_init(&task->worker, pass_task_worker);
+    task->sat = *sat;
+    task->sat.elsetrec = sgp4_copy(sat->elsetrec);
+    task->sat.obj.id = NULL;
+    task->sat.obj.parent = NULL;
+    task->sat.obj.children = task->sat.obj.prev = task->sat.obj.next = NULL;
+    task->sat.data = NULL;
+    task->sat.json_line = NULL;
+    task->sat.names = NULL;
+    task->sat.visible_next = task->sat.visible_prev = NULL;
+}
+
+static void pass_task_release(pass_task_t *task)
+{
+    free(task->sat.elsetrec);
+    free(task->passes);
+}
+
+/*
+ * Move the task observer to a new time.
+ *
+ * Only the utc, ut1 and tt values are changed, which is enough for the fast
+ * altitude computation and the visibility prefilter.
+ */
+static void pass_set_time(pass_task_t *task, double utc)
+{
+    task->obs.ut1 += utc - task->obs.utc;
+    task->obs.tt += utc - task->obs.utc;
+    task->obs.utc = utc;
+}
+
+static double pass_get_alt(pass_task_t *task, double utc)
+{
+    double alt;
+    pass_set_time(task, utc);
+    if (!satellite_is_operational(&task->sat, utc)) return -M_PI / 2;
+    if (satellite_get_altitude(&task->sat.obj, &task->obs, &alt))
+        return NAN;
+    return alt;
+}
+
+static double pass_get_vmag(pass_task_t *task, double utc)
+{
+    pass_set_time(task, utc);
+    observer_update(&task->obs, false);
+    satellite_update(&task->sat, &task->obs);
+    return task->sat.vmag;
+}
+
+// Bisection search of the time the satellite crosses min_alt.
+static double pass_find_crossing(pass_task_t *task, double t0, double t1,
+                                 bool rising)
+{
+    double t;
+    while (t1 - t0 > PASS_PRECISION) {
+        t = (t0 + t1) / 2;
+        if ((pass_get_alt(task, t) > task->min_alt) == rising)
+            t1 = t;
+        else
+            t0 = t;
+    }
+    return (t0 + t1) / 2;
+}
+
+// Golden section search of the max altitude time.
+static double pass_find_culmination(pass_task_t *task, double t0, double t1)
+{
+    const double g = (sqrt(5) - 1) / 2;
+    double a, b, fa, fb;
+
+    a = t1 - g * (t1 - t0);
+    b = t0 + g * (t1 - t0);
+    fa = pass_get_alt(task, a);
+    fb = pass_get_alt(task, b);
+    while (t1 - t0 > PASS_PRECISION) {
+        if (fa > fb) {
+            t1 = b;
+            b = a;
+            fb = fa;
+            a = t1 - g * (t1 - t0);
+            fa = pass_get_alt(task, a);
+        } else {
+            t0 = a;
+            a = b;
+            fa = fb;
+            b = t0 + g * (t1 - t0);
+            fb = pass_get_alt(task, b);
+        }
+    }
+    return (t0 + t1) / 2;
+}
+
+static void pass_add(pass_task_t *task, double rise, double set)
+{
+    sat_pass_t *pass;
+    int i;
+
+    task->passes = realloc(task->passes,
+                           (task->nb + 1) * sizeof(*task->passes));
+    pass = &task->passes[task->nb++];
+    pass->rise = rise;
+    pass->set = set;
+    pass->culmination = pass_find_culmination(task, rise, set);
+    pass->max_alt = pass_get_alt(task, pass->culmination);
+    pass->vmag = pass_get_vmag(task, pass->culmination);
+    for (i = 0; i < PASS_VMAG_SAMPLES; i++) {
+        pass->vmag = fmin(pass->vmag, pass_get_vmag(
+                    task, mix(rise, set, (i + 0.5) / PASS_VMAG_SAMPLES)));
+    }
+}
+
+/*
+ * Compute all the passes of a satellite in the task time range.
+ *
+ * We first step through the range until the altitude crosses min_alt,
+ * using the visibility prefilter to skip the times when the satellite
+ * is known to be below the horizon, then refine the rise and set times.
+ * Passes that already started at the start time get it as rise time,
+ * and passes not finished at the end time get it as set time.
+ */
+static int pass_task_worker(worker_t *worker)
+{
+    pass_task_t *task = (void*)worker;
+    prefilter_t prefilter;
+    double t = task->start, t2, rise = NAN, alt;
+
+    alt = pass_get_alt(task, t);
+    if (alt > task->min_alt) rise = t;
+    while (t < task->end && !isnan(alt)) {
+        t2 = t + PASS_STEP;
+        if (isnan(rise) && task->min_alt >= 0) {
+            pass_set_time(task, t);
+            compute_prefilter(&task->sat, &task->obs, &prefilter);
+            if (prefilter.hidden) t2 = fmax(t2, t + prefilter.duration);
+        }
+        t2 = fmin(t2, task->end);
+        alt = pass_get_alt(task, t2);
+        if (isnan(alt)) break;
+        if (isnan(rise) && alt > task->min_alt) {
+            rise = pass_find_crossing(task, t, t2, true);
+        } else if (!isnan(rise) && alt <= task->min_alt) {
+            pass_add(task, rise, pass_find_crossing(task, t, t2, false));
+            rise = NAN;
+        }
+        t = t2;
+    }
+    if (!isnan(rise)) pass_add(task, rise, t);
+    return 0;
+}
+
+static satellite_t *satellites_find(const satellites_t *sats, int number)
+{
+    satellite_t *sat;
+    MODULE_ITER(sats, sat, "tle_satellite") {
+        if (sat->number == number) return sat;
+    }
+    return NULL;
+}
+
+/*
+ * Function: compute_passes
+ * Start to compute the passes of a list of satellites above the current
+ * observer.
+ *
+ * Each satellite is computed in its own worker, run from the module
+ * update.  Use <get_passes> with the returned id to get the result.
+ *
+ * Arguments (as a json object):
+ *   norad_numbers  - Array of satellites NORAD numbers.
+ *   start          - Start of the time range (UTC MJD).
+ *   end            - End of the time range (UTC MJD).
+ *   min_alt        - Optional min altitude (rad), default to zero.
+ *
+ * Return:
+ *   The id of the computation.
+ */
+static json_value *satellites_compute_passes_fn(
+        obj_t *obj, const attribute_t *attr, const json_value *args)
+{
+    satellites_t *sats = (void*)obj;
+    const json_value *numbers;
+    double start, end, min_alt;
+    int i, j, r;
+    passes_job_t *job;
+    pass_task_t *task;
+    satellite_t *sat;
+
+    r = jcon_parse(args, "{",
+        "norad_numbers", JCON_VAL(numbers),
+        "start", JCON_DOUBLE(start, 0),
+        "end", JCON_DOUBLE(end, 0),
+        "?min_alt", JCON_DOUBLE(min_alt, 0),
+    "}");
+    if (r || numbers->type != json_array || end < start) {
+        LOG_E("Wrong compute_passes arguments");
+        return NULL;
+    }
+    if (end - start > PASS_MAX_RANGE) {
+        LOG_W("Passes time range limited to %g days", PASS_MAX_RANGE);
+        end = start + PASS_MAX_RANGE;
+    }
+
+    job = calloc(1, sizeof(*job));
+    job->id = ++sats->passes_last_id;
+    job->tasks = calloc(numbers->u.array.length, sizeof(*job->tasks));
+    for (i = 0; i < numbers->u.array.length; i++) {
+        if (numbers->u.array.values[i]->type != json_integer) continue;
+        sat = satellites_find(sats, numbers->u.array.values[i]->u.integer);
+        if (!sat || sat->error) continue;
+        // Skip the duplicated satellites.
+        for (j = 0; j < job->nb; j++)
+            if (job->tasks[j].sat.number == sat->number) break;
+        if (j < job->nb) continue;
+        task = &job->tasks[job->nb++];
+        pass_task_init(task, sat);
+        task->obs = *core->observer;
+        task->start = start;
+        task->end = end;
+        task->min_alt = min_alt;
+    }
+    DL_APPEND(sats->passes_jobs, job);
+    return json_integer_new(job->id);
+}
+
+// Run the workers of the compute_passes jobs.
+static void satellites_update_passes(satellites_t *sats)
+{
+    passes_job_t *job;
+    int i;
+
+    DL_FOREACH(sats->passes_jobs, job) {
+        if (job->done) continue;
+        job->done = true;
+        for (i = 0; i < job->nb; i++) {
+            if (!job->tasks[i].done)
+                job->tasks[i].done = worker_iter(&job->tasks[i].worker);
+            job->done = job->done && job->tasks[i].done;
+        }
+    }
+}
+
+/*
+ * Function: get_passes
+ * Get the result of a <compute_passes> call.
+ *
+ * Once returned, the result is released, so this can only succeed once
+ * per computation.
+ *
+ * Arguments:
+ *   id - The id returned by compute_passes.
+ *
+ * Return:
+ *   Null if the computation is still running, otherwise a json array of
+ *   passes, with for each of them the attributes: norad_number, rise,
+ *   culmination, set, max_alt and vmag.
+ */
+static json_value *satellites_get_passes_fn(
+        obj_t *obj, const attribute_t *attr, const json_value *args)
+{
+    satellites_t *sats = (void*)obj;
+    passes_job_t *job;
+    const pass_task_t *task;
+    const sat_pass_t *pass;
+    json_value *ret, *jpass;
+    int i, j, id;
+
+    if (!args || args->type != json_integer) {
+        LOG_E("Wrong get_passes arguments");
+        return NULL;
+    }
+    id = args->u.integer;
+    DL_FOREACH(sats->passes_jobs, job) {
+        if (job->id == id) break;
+    }
+    if (!job) {
+        LOG_W("No passes computation with id %d", id);
+        return NULL;
+    }
+    if (!job->done) return NULL;
+
+    ret = json_array_new(0);
+    for (i = 0; i < job->nb; i++) {
+        task = &job->tasks[i];
+        for (j = 0; j < task->nb; j++) {
+            pass = &task->passes[j];
+            jpass = json_array_push(ret, json_object_new(0));
+            json_object_push(jpass, "norad_number",
+                             json_integer_new(task->sat.number));
+            json_object_push(jpass, "rise", json_double_new(pass->rise));
+            json_object_push(jpass, "culmination",
+                             json_double_new(pass->culmination));
+            json_object_push(jpass, "set", json_double_new(pass->set));
+            json_object_push(jpass, "max_alt",
+                             json_double_new(pass->max_alt));
+            json_object_push(jpass, "vmag", json_double_new(pass->vmag));
+        }
+        pass_task_release(&job->tasks[i]);
+    }
+    DL_DELETE(sats->passes_jobs, job);
+    free(job->tasks);
+    free(job);
+    return ret;
+}
+
 /*
  * Meta class declarations.
  */
@@ -800,6 +1551,8 @@ static obj_klass_t satellites_klass = {
         PROPERTY(hints_mag_offset, TYPE_FLOAT,
                  MEMBER(satellites_t, hints_mag_offset)),
         PROPERTY(hints_visible, TYPE_BOOL, MEMBER(satellites_t, hints_visible)),
+        FUNCTION(compute_passes, .fn = satellites_compute_passes_fn),
+        FUNCTION(get_passes, .fn = satellites_get_passes_fn),
         {}
     }
 };
@@ -845,6 +1598,7 @@ static void check_sat(
 
     satellite_get_altitude(obj, &obs, &alt);
     assert(fabs(ha_alt - alt * DR2D) < 1);
+    assert(!satellite_is_hidden((satellite_t*)obj, &obs));
 
     obj_release(obj);
 }
@@ -914,4 +1668,135 @@ static void test_satellites(void)
 
 TEST_REGISTER(NULL, test_satellites, TEST_AUTO);
 
+static void test_passes(void)
+{
+    pass_task_t task = {};
+    observer_t obs, core_obs;
+    obj_t *obj, *fresh;
+    satellite_t *sat;
+    const sat_pass_t *pass;
+    int i, j, nb = 0;
+    double t, alt, prev_alt = -1, vmag, vmag_min, live_pvo[2][3];
+    json_value *args, *ret;
+    const char *json =
+        "{\"model_data\":{\"mag\": -1.8, \"norad_number\": 25544,"
+        "\"tle\": ["
+        "\"1 25544U 98067A   20115.55025390  .00016717  00000-0  "
+        "10270-3 0  9027\","
+        "\"2 25544  51.6412 253.9367 0001868 190.8144 169.2966 "
+        "15.49324997 23698\"]}}";
+
+    obj = obj_create_str("tle_satellite", json);
+    assert(obj);
+    sat = (satellite_t*)obj;
+    obs = *core->observer;
+    obs.elong = 121.5654 * DD2R;
+    obs.phi = 25.0330 * DD2R;
+    obj_set_attr((obj_t*)&obs, "utc", 58963.0);
+    observer_update(&obs, false);
+    satellite_update(sat, &obs);
+    memcpy(live_pvo, sat->pvo, sizeof(live_pvo));
+    vmag = sat->vmag;
+
+    pass_task_init(&task, sat);
+    task.obs = obs;
+    task.start = obs.utc;
+    task.end = task.start + 1;
+    pass_task_worker(&task.worker);
+
+    // The rendered satellite is not changed by the task.
+    assert(memcmp(live_pvo, sat->pvo, sizeof(live_pvo)) == 0);
+    assert(sat->vmag == vmag && !sat->error);
+
+    // Compare with a brute force scan, one minute per step.
+    for (t = task.start; t < task.end; t += 1. / 1440) {
+        alt = pass_get_alt(&task, t);
+        if (alt > 0 && prev_alt <= 0) nb++;
+        prev_alt = alt;
+    }
+    assert(task.nb == nb && nb > 0);
+
+    // Compare the magnitudes with a new satellite updated from scratch at
+    // each sample time of the passes.
+    fresh = obj_create_str("tle_satellite", json);
+    for (i = 0; i < task.nb; i++) {
+        pass = &task.passes[i];
+        assert(pass->rise < pass->culmination);
+        assert(pass->culmination < pass->set);
+        assert(pass->max_alt > 0);
+        vmag_min = INFINITY;
+        for (j = -1; j < PASS_VMAG_SAMPLES; j++) {
+            t = (j == -1) ? pass->culmination :
+                mix(pass->rise, pass->set, (j + 0.5) / PASS_VMAG_SAMPLES);
+            obj_set_attr((obj_t*)&obs, "utc", t);
+            observer_update(&obs, false);
+            satellite_update((satellite_t*)fresh, &obs);
+            assert(((satellite_t*)fresh)->vmag < 99);
+            vmag_min = fmin(vmag_min, ((satellite_t*)fresh)->vmag);
+        }
+        assert(fabs(pass->vmag - vmag_min) < 0.01);
+    }
+    obj_release(fresh);
+    pass_task_release(&task);
+
+    // Same thing through the module functions.
+    if (g_satellites) {
+        core_obs = *core->observer;
+        core->observer->elong = obs.elong;
+        core->observer->phi = obs.phi;
+        observer_update(core->observer, false);
+        module_add(&g_satellites->obj, obj);
+        args = json_parse(
+                "{\"norad_numbers\": [25544], \"start\": 58963, "
+                "\"end\": 58964}", 100);
+        ret = obj_call_json(&g_satellites->obj, "compute_passes", args);
+        json_value_free(args);
+        assert(ret && ret->type == json_integer);
+        args = json_integer_new(ret->u.integer);
+        json_builder_free(ret);
+        while (!(ret = obj_call_json(&g_satellites->obj, "get_passes", args)))
+            satellites_update(&g_satellites->obj, 0);
+        assert(ret->u.array.length == nb);
+        json_builder_free(ret);
+        assert(!g_satellites->passes_jobs);
+        json_builder_free(args);
+        module_remove(&g_satellites->obj, obj);
+        *core->observer = core_obs;
+    }
+    obj_release(obj);
+}
+
+TEST_REGISTER(NULL, test_passes, TEST_AUTO);
+
+static void test_parse_record(void)
+{
+    sat_record_t rec;
+    const char *line =
+        "{\"types\": [\"Asa\"], \"model\": \"tle_satellite\", "
+        "\"model_data\": {\"norad_number\": 25544, \"mag\": -1.8, "
+        "\"tle\": [\"1 25544U\", \"2 25544\"], \"group\": [\"a\"], "
+        "\"x\": {\"y\": [1, {\"z\": \"}\"}]}, \"decay_date\": null, "
+        "\"launch_date\": \"1998-11-20\"}, "
+        "\"names\": [\"NAME ISS \\\"Zarya\\\"\", \"NAME Caf\\u00e9\", "
+        "\"NORAD 25544\"], \"interest\": 3.1}";
+
+    assert(parse_record(line, &rec) == 0);
+    assert(rec.number == 25544);
+    assert(rec.stdmag == -1.8);
+    test_str(rec.type, "Asa");
+    test_str(rec.tle[0], "1 25544U");
+    test_str(rec.tle[1], "2 25544");
+    test_str(rec.launch_date, "1998-11-20");
+    test_str(rec.decay_date, "");
+    test_str(rec.names, "NAME ISS \"Zarya\"");
+    test_str(rec.names + 17, "NAME Café");
+    test_str(rec.names + 28, "NORAD 25544");
+    assert(rec.names_size == 41);
+
+    assert(parse_record("{\"model_data\": {\"tle\": [\"1\"]}}", &rec));
+    assert(parse_record("{\"names\": [\"abc", &rec));
+}
+
+TEST_REGISTER(NULL, test_parse_record, TEST_AUTO);
+
 #endif // COMPILE_TESTS
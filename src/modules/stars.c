@@ -20,6 +20,10 @@
 
 static const double LABEL_SPACING = 4;
 
+// Max error (in window pixels) allowed when reusing the stars astrometric
+// positions computed at a previous frame.
+static const double ASTROM_MAX_ERR = 0.25;
+
 static obj_klass_t star_klass;
 
 typedef struct stars stars_t;
@@ -80,6 +84,20 @@ typedef struct tile {
     double      illuminance; // Totall illuminance (lux).
     int         nb;
     star_t      *sources;
+    // Upper bounds of the stars angular speed (rad/day) and of the angular
+    // shift due to a displacement of the observer (rad/AU).
+    double      max_motion;
+    double      max_parallax;
+
+    // Astrometric positions of the first stars of the tile, computed
+    // for a given time and earth position.  Since the stars barely move,
+    // we only recompute them when the error becomes visible.
+    struct {
+        int     nb;
+        double  (*pos)[3];
+        double  tt;
+        double  earth_pos[3];
+    } astrom;
 } tile_t;
 
 static void nuniq_to_pix(uint64_t nuniq, int *order, int *pix)
@@ -439,6 +457,7 @@ static int del_tile(void *data)
         free(tile->sources[i].sp_type);
     }
     free(tile->sources);
+    free(tile->astrom.pos);
     free(tile);
     return 0;
 }
@@ -557,6 +576,10 @@ static int on_file_tile_loaded(const char type[4],
 
         compute_pv(ra, de, pra, pde, plx, epoch, s);
         s->illuminance = core_mag_to_illuminance(vmag);
+        tile->max_motion = fmax(tile->max_motion,
+                vec3_norm(s->pvo[1]) / vec3_norm(s->pvo[0]));
+        tile->max_parallax = fmax(tile->max_parallax,
+                1.0 / vec3_norm(s->pvo[0]));
 
         tile->illuminance += s->illuminance;
         tile->mag_min = fmin(tile->mag_min, vmag);
@@ -588,7 +611,10 @@ static void *stars_create_tile(
     survey_t *survey = user;
     eph_load(data, size, USER_PASS(survey, &tile, transparency),
              on_file_tile_loaded);
-    if (tile) *cost = tile->nb * sizeof(*tile->sources);
+    if (tile) {
+        *cost = tile->nb * (sizeof(*tile->sources) +
+                            sizeof(*tile->astrom.pos));
+    }
     return tile;
 }
 
@@ -642,6 +668,30 @@ static tile_t *get_tile(survey_t *survey, int order, int pix,
     return tile;
 }
 
+/*
+ * Invalidate the cached astrometric positions of a tile if the observer
+ * time or position changed too much since we computed them.
+ */
+static void tile_check_astrom(tile_t *tile, const painter_t *painter)
+{
+    const observer_t *obs = painter->obs;
+    double err, max_err;
+
+    if (!tile->astrom.pos)
+        tile->astrom.pos = malloc(tile->nb * sizeof(*tile->astrom.pos));
+    if (tile->astrom.nb) {
+        err = tile->max_motion * fabs(obs->tt - tile->astrom.tt) +
+              tile->max_parallax * vec3_dist(obs->earth_pvb[0],
+                                             tile->astrom.earth_pos);
+        max_err = ASTROM_MAX_ERR * 2.0 / (fabs(painter->proj->mat[1][1]) *
+                                          painter->proj->window_size[1]);
+        if (err < max_err) return;
+    }
+    tile->astrom.nb = 0;
+    tile->astrom.tt = obs->tt;
+    vec3_copy(obs->earth_pvb[0], tile->astrom.earth_pos);
+}
+
 static int render_visitor(stars_t *stars, survey_t *survey,
                           int order, int pix,
                           const painter_t *painter_,
@@ -654,7 +704,7 @@ static int render_visitor(stars_t *stars, survey_t *survey,
     star_t *s;
     double p_win[4], size = 0, luminance = 0, vmag = -DBL_MAX;
     double color[3];
-    double v[3];
+    const double *v;
     double limit_mag = fmin(painter.stars_limit_mag, painter.hard_limit_mag);
     bool selected;
 
@@ -670,12 +720,19 @@ static int render_visitor(stars_t *stars, survey_t *survey,
     if (!tile) goto end;
     if (tile->mag_min > limit_mag) goto end;
 
+    tile_check_astrom(tile, &painter);
     point_t *points = malloc(tile->nb * sizeof(*points));
     for (i = 0; i < tile->nb; i++) {
         s = &tile->sources[i];
         if (s->vmag > limit_mag) break;
 
-        star_get_astrom(s, painter.obs, v);
+        // We always iterate the stars in the same order, so we only have
+        // to compute the positions past the ones already cached.
+        if (i == tile->astrom.nb) {
+            star_get_astrom(s, painter.obs, tile->astrom.pos[i]);
+            tile->astrom.nb++;
+        }
+        v = tile->astrom.pos[i];
         if (!painter_project(&painter, FRAME_ASTROM, v, true, true, p_win))
             continue;
 
@@ -142,9 +142,12 @@ struct obj_klass
     // The caller takes the ownership of the returned json object.
     json_value *(*get_json_data)(const obj_t *obj);
 
-    bool (*is_point_occulted)(const obj_t *obj,
-                              const double pos[3], bool at_inf,
-                              const observer_t *obs, const obj_t *ignore);
+    // List the objects that can hide the objects behind them, as spheres
+    // in ICRF with origin on the observer (AU).  Used to hide the labels.
+    void (*get_occulters)(const obj_t *obj, const observer_t *obs,
+                          void *user,
+                          void (*f)(void *user, const obj_t *occulter,
+                                    const double pos[3], double radius));
 
     void (*gui)(obj_t *obj, int location);
 
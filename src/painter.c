@@ -12,9 +12,22 @@
 #include "render.h"
 
 #include <float.h>
+#include <zlib.h> // For crc32
+
+// Max error allowed on the cached render lists (pixels).
+#define PAINT_CACHE_MAX_ERR 0.5
+
+// Earth rotation rate (rad/day).
+#define EARTH_ROT_RATE (2 * M_PI * 1.00273781191135448)
 
 static bool g_debug = false;
 
+// Statistics about the quads clipping test, reset at each frame.
+static struct {
+    int nb_tested;
+    int nb_culled_by_polygon; // Tiles only culled by the viewport polygon.
+} g_clip_stats;
+
 // Test if a shape in clipping coordinates is clipped or not.
 static bool is_clipped(int n, double (*pos)[4])
 {
@@ -62,50 +75,103 @@ static bool intersect_circle_rect(
 }
 
 
+/*
+ * Compute a cap containing the viewport, from the great circle going
+ * through two border points.  The cap is enlarged to contain all the
+ * border points, since the sides of the screen can be curved.
+ */
+static void compute_border_cap(const double (*border)[3], int n,
+                               int a, int b, const double center[3],
+                               double cap[4])
+{
+    int i;
+    vec3_cross(border[a], border[b], cap);
+    vec3_normalize(cap, cap);
+    if (vec3_dot(cap, center) < 0) vec3_mul(-1, cap, cap);
+    cap[3] = 0;
+    for (i = 0; i < n; i++)
+        cap[3] = fmin(cap[3], vec3_dot(cap, border[i]) - 1e-9);
+}
+
 /*
  * Function: compute_viewport_cap
- * Compute the viewport cap (in given frame).
+ * Compute the viewport caps (in given frame).
+ *
+ * The caps are computed by unprojecting points along the screen border,
+ * so that they also work for the projections where the sides of the
+ * screen are not great circles.
+ *
+ * We compute one cap per side of the screen, used by all the clipping
+ * tests, and one cap per edge of the viewport polygon, only used by the
+ * quads clipping test.  We don't keep the edge caps that don't clip
+ * anything more than the bounding cap, or that are almost the same as
+ * a cap we already have.
  */
 static void compute_viewport_cap(painter_t *painter, int frame)
 {
-    int i;
-    double p[4][3];
-    double c[3];
+    const int split = 2 * VIEWPORT_POLYGON_SPLIT;
+    const int n = 4 * VIEWPORT_POLYGON_SPLIT;
+    const double eps = 1e-6; // Min distance between two caps normals.
+    int i, j, side;
+    // Border points: the polygon vertices interleaved with the middle
+    // point of each edge.
+    double win[2 * 4 * VIEWPORT_POLYGON_SPLIT][2];
+    double border[2 * 4 * VIEWPORT_POLYGON_SPLIT][3];
+    double *edge;
     const double w = painter->proj->window_size[0];
     const double h = painter->proj->window_size[1];
+    const double corners[5][2] = {{0, 0}, {w, 0}, {w, h}, {0, h}, {0, 0}};
     double max_sep = 0;
-    double* cap = painter->clip_info[frame].bounding_cap;
+    typeof(painter->clip_info[frame]) *clip = &painter->clip_info[frame];
+    double *cap = clip->bounding_cap;
     bool r;
 
     painter_unproject(painter, frame, VEC(w / 2, h / 2), cap);
     assert(vec3_is_normalized(cap));
 
-    #define MARGIN 0
-    r  = painter_unproject(painter, frame, VEC(MARGIN, MARGIN), p[0]);
-    r &= painter_unproject(painter, frame, VEC(w - MARGIN, MARGIN), p[1]);
-    r &= painter_unproject(painter, frame, VEC(w - MARGIN, h - MARGIN), p[2]);
-    r &= painter_unproject(painter, frame, VEC(MARGIN, h - MARGIN), p[3]);
+    for (i = 0; i < 2 * n; i++) {
+        side = i / split;
+        vec2_mix(corners[side], corners[side + 1], (double)(i % split) / split,
+                 win[i]);
+    }
+    r = painter_unproject_n(painter, frame, 2 * n, win, border);
     if (!r) max_sep = M_PI;
 
-    // Compute max separation from all corners.
-    for (i = 0; i < 4; i++) {
-        assert(vec3_is_normalized(p[i]));
-        max_sep = fmax(max_sep, vec3_sep(cap, p[i]));
+    // Compute max separation from all the border points.
+    for (i = 0; i < 2 * n; i++) {
+        assert(vec3_is_normalized(border[i]));
+        max_sep = fmax(max_sep, vec3_sep(cap, border[i]));
     }
     cap[3] = cos(max_sep);
 
     // Compute side caps
+    clip->nb_viewport_caps = 0;
+    clip->nb_polygon_caps = 0;
     if (max_sep > M_PI_2)
         return;
 
-    painter->clip_info[frame].nb_viewport_caps = 4;
-    for (i = 0; i < 4; i++) {
-        vec3_cross(p[i], p[(i + 1) % 4], c);
-        vec3_normalize(c, c);
-        vec3_copy(c, painter->clip_info[frame].viewport_caps[i]);
-        if (!cap_contains_vec3(painter->clip_info[frame].viewport_caps[i], cap))
-            vec3_mul(-1, painter->clip_info[frame].viewport_caps[i],
-                         painter->clip_info[frame].viewport_caps[i]);
+    clip->nb_viewport_caps = 4;
+    for (side = 0; side < 4; side++) {
+        compute_border_cap(border, 2 * n, side * split,
+                           (side + 1) * split % (2 * n), cap,
+                           clip->viewport_caps[side]);
+    }
+
+    // Compute the polygon edges caps.
+    for (i = 0; i < n; i++) {
+        edge = clip->polygon_caps[clip->nb_polygon_caps];
+        compute_border_cap(border, 2 * n, 2 * i, (2 * i + 2) % (2 * n), cap,
+                           edge);
+        if (cap_contains_cap(edge, cap)) continue;
+        for (j = 0; j < 4; j++) {
+            if (vec3_dot(edge, clip->viewport_caps[j]) > 1 - eps) break;
+        }
+        if (j < 4) continue;
+        for (j = 0; j < clip->nb_polygon_caps; j++) {
+            if (vec3_dot(edge, clip->polygon_caps[j]) > 1 - eps) break;
+        }
+        if (j < clip->nb_polygon_caps) continue;
+        clip->nb_polygon_caps++;
     }
 }
 
@@ -134,6 +200,7 @@ int paint_prepare(painter_t *painter, double win_w, double win_h,
     for (i = 0; i < ARRAY_SIZE(painter->textures); i++)
         mat3_set_identity(painter->textures[i].mat);
     areas_clear_all(core->areas);
+    memset(&g_clip_stats, 0, sizeof(g_clip_stats));
 
     cull_flipped = (bool)(painter->proj->flags & PROJ_FLIP_HORIZONTAL) !=
                    (bool)(painter->proj->flags & PROJ_FLIP_VERTICAL);
@@ -148,6 +215,34 @@ int paint_finish(const painter_t *painter)
     return 0;
 }
 
+bool paint_cache_replay(const painter_t *painter, const paint_cache_t *cache,
+                        uint32_t key)
+{
+    if (!cache->list || cache->key != key) return false;
+    render_replay(painter->rend, cache->list);
+    return true;
+}
+
+void paint_cache_record_begin(const painter_t *painter)
+{
+    render_record_begin(painter->rend);
+}
+
+void paint_cache_record_end(const painter_t *painter, paint_cache_t *cache,
+                            uint32_t key)
+{
+    render_list_delete(cache->list);
+    cache->list = render_record_end(painter->rend);
+    cache->key = key;
+}
+
+void paint_cache_release(paint_cache_t *cache)
+{
+    render_list_delete(cache->list);
+    cache->list = NULL;
+    cache->key = 0;
+}
+
 /*
  * Set the current painter texture.
  *
@@ -355,8 +450,8 @@ int paint_linestring(const painter_t *painter, int frame,
     for (i = 0; i < size; i++) {
         convert_frame(painter->obs, frame, FRAME_VIEW, true,
                       points[i], pos_line[i]);
-        project_to_win(painter->proj, pos_line[i], win_line[i]);
     }
+    project_to_win_n(painter->proj, size, pos_line, win_line);
     render_line(painter->rend, painter, pos_line, win_line, size);
     free(win_line);
     free(pos_line);
@@ -399,17 +494,17 @@ int paint_mesh(const painter_t *painter_, int frame, int mode,
     switch (mode) {
     case MODE_TRIANGLES:
         render_mesh(painter.rend, &painter, frame, mode,
-             mesh->vertices_count, mesh->vertices,
+             mesh->vertices_count, mesh->vertices, mesh->colors,
              mesh->triangles_count, mesh->triangles, use_stencil);
         break;
     case MODE_LINES:
         render_mesh(painter.rend, &painter, frame, mode,
-             mesh->vertices_count, mesh->vertices,
+             mesh->vertices_count, mesh->vertices, mesh->colors,
              mesh->lines_count, mesh->lines, false);
         break;
     case MODE_POINTS:
         render_mesh(painter.rend, &painter, frame, mode,
-             mesh->vertices_count, mesh->vertices,
+             mesh->vertices_count, mesh->vertices, mesh->colors,
              mesh->points_count, mesh->points, false);
         break;
     }
@@ -430,12 +525,12 @@ subdivide:
     switch (mode) {
     case MODE_TRIANGLES:
         render_mesh(painter.rend, &painter, FRAME_VIEW, mode,
-                 mesh2->vertices_count, mesh2->vertices,
+                 mesh2->vertices_count, mesh2->vertices, mesh2->colors,
                  mesh2->triangles_count, mesh2->triangles, use_stencil);
         break;
     case MODE_LINES:
         render_mesh(painter.rend, &painter, FRAME_VIEW, mode,
-                 mesh2->vertices_count, mesh2->vertices,
+                 mesh2->vertices_count, mesh2->vertices, mesh2->colors,
                  mesh2->lines_count, mesh2->lines, false);
         break;
     }
@@ -449,8 +544,13 @@ void paint_debug(bool value)
     g_debug = value;
 }
 
-bool painter_is_cap_clipped(const painter_t *painter, int frame,
-                            const double cap[4])
+/*
+ * Test if a cap is clipped.  If by_polygon is not NULL, we also test the
+ * viewport polygon edges, and set it to true if the cap is only clipped
+ * by them.
+ */
+static bool is_cap_clipped(const painter_t *painter, int frame,
+                           const double cap[4], bool *by_polygon)
 {
     int i;
 
@@ -464,17 +564,26 @@ bool painter_is_cap_clipped(const painter_t *painter, int frame,
 
     const typeof (painter->clip_info[frame]) *clipinfo =
             &painter->clip_info[frame];
-    if (clipinfo->nb_viewport_caps > 0) {
-        for (i = 0; i < clipinfo->nb_viewport_caps; ++i) {
-            if (!cap_intersects_cap(clipinfo->viewport_caps[i], cap)) {
-                // LOG_E("clipped cap!");
-                return true;
-            }
+    for (i = 0; i < clipinfo->nb_viewport_caps; ++i) {
+        if (!cap_intersects_cap(clipinfo->viewport_caps[i], cap))
+            return true;
+    }
+    if (!by_polygon) return false;
+    for (i = 0; i < clipinfo->nb_polygon_caps; ++i) {
+        if (!cap_intersects_cap(clipinfo->polygon_caps[i], cap)) {
+            *by_polygon = true;
+            return true;
         }
     }
     return false;
 }
 
+bool painter_is_cap_clipped(const painter_t *painter, int frame,
+                            const double cap[4])
+{
+    return is_cap_clipped(painter, frame, cap, NULL);
+}
+
 bool painter_is_point_clipped_fast(const painter_t *painter, int frame,
                                    const double pos[3], bool is_normalized)
 {
@@ -523,11 +632,15 @@ bool painter_is_quad_clipped(const painter_t *painter, int frame,
     double bounding_cap[4];
     int i;
     int order = map->order;
+    bool by_polygon = false;
 
     uv_map_get_bounding_cap(map, bounding_cap);
     assert(vec3_is_normalized(bounding_cap));
-    if (painter_is_cap_clipped(painter, frame, bounding_cap))
+    g_clip_stats.nb_tested++;
+    if (is_cap_clipped(painter, frame, bounding_cap, &by_polygon)) {
+        g_clip_stats.nb_culled_by_polygon += by_polygon ? 1 : 0;
         return true;
+    }
     if (order < 2)
         return false;
 
@@ -619,6 +732,41 @@ bool painter_is_planet_healpix_clipped(const painter_t *painter,
     return painter_is_planet_quad_clipped(painter, FRAME_ICRF, &map);
 }
 
+int painter_get_quad_split(const painter_t *painter, int frame,
+                           const uv_map_t *map, int max_split,
+                           double max_err)
+{
+    // Indices of the middle points in a 3x3 grid, and of the two points
+    // they are linearly interpolated from when rendering.
+    const int PROBES[5][3] = {
+        {1, 0, 2}, {3, 0, 6}, {5, 2, 8}, {7, 6, 8}, {4, 2, 6}};
+    double grid[9][4], pos[9][3], win[9][3], mid[2], err = 0;
+    int i, split;
+
+    if (max_split <= 1) return max_split;
+    // The distortion of large quads is not well estimated from the middle
+    // points only.
+    if (map->type == UV_MAP_HEALPIX && map->order < 3) return max_split;
+
+    uv_map_grid(map, 2, grid, NULL);
+    for (i = 0; i < 9; i++) {
+        convert_framev4(painter->obs, frame, FRAME_VIEW, grid[i], grid[i]);
+        vec3_copy(grid[i], pos[i]);
+    }
+    if (!project_to_win_n(painter->proj, 9, pos, win))
+        return max_split;
+    for (i = 0; i < 5; i++) {
+        vec2_mix(win[PROBES[i][1]], win[PROBES[i][2]], 0.5, mid);
+        err = fmax(err, vec2_dist(mid, win[PROBES[i][0]]));
+    }
+
+    // The error decreases with the square of the split.
+    for (split = 1; split < max_split; split *= 2) {
+        if (err <= max_err * split * split) break;
+    }
+    return split;
+}
+
 
 /* Draw the contour lines of a shape.
  *
@@ -831,6 +979,13 @@ int paint_2d_line(const painter_t *painter, const double transf[3][3],
     return 0;
 }
 
+int paint_2d_lines(const painter_t *painter, int n,
+                   const double (*lines)[2][2])
+{
+    render_lines_2d(painter->rend, painter, n, lines);
+    return 0;
+}
+
 void paint_cap(const painter_t *painter, int frame, double cap[4])
 {
     double r;
@@ -975,3 +1130,128 @@ bool painter_unproject(const painter_t *painter, int frame,
     convert_frame(painter->obs, FRAME_VIEW, frame, true, p, pos);
     return ret;
 }
+
+void painter_get_clip_stats(int *nb_tested, int *nb_culled_by_polygon)
+{
+    *nb_tested = g_clip_stats.nb_tested;
+    *nb_culled_by_polygon = g_clip_stats.nb_culled_by_polygon;
+}
+
+bool painter_unproject_n(const painter_t *painter, int frame, int n,
+                         const double (*win_pos)[2], double (*pos)[3])
+{
+    int i;
+    bool ret;
+    for (i = 0; i < n; i++)
+        vec3_set(pos[i], win_pos[i][0], win_pos[i][1], 0);
+    ret = unproject_n(painter->proj, n, pos, pos);
+    for (i = 0; i < n; i++) {
+        vec3_normalize(pos[i], pos[i]);
+        convert_frame(painter->obs, FRAME_VIEW, frame, true, pos[i], pos[i]);
+    }
+    return ret;
+}
+
+uint32_t painter_get_view_key(const painter_t *painter, double max_err)
+{
+    const observer_t *obs = painter->obs;
+    const projection_t *proj = painter->proj;
+    double step;
+    int64_t t;
+    uint32_t v;
+
+    step = max_err * proj->fovy / proj->window_size[1] / EARTH_ROT_RATE;
+    t = floor(obs->tt / step);
+    #define H(a) v = crc32(v, (const void*)&(a), sizeof(a))
+    v = 0;
+    H(obs->hash_partial);
+    H(obs->ro2m);
+    H(obs->pitch);
+    H(obs->yaw);
+    H(obs->roll);
+    H(obs->view_offset_alt);
+    // On the ground obs_pvg follows the earth rotation, which is already
+    // covered by the time step.
+    if (obs->space) H(obs->obs_pvg);
+    H(t);
+    H(proj->klass);
+    H(proj->fovy);
+    H(proj->flags);
+    H(proj->mat);
+    H(proj->window_size);
+    #undef H
+    return v ?: 1; // Zero is used for invalid cache entries.
+}
+
+uint32_t painter_get_cache_key(const painter_t *painter,
+                               const void *data, int size)
+{
+    int i;
+    const texture_t *tex;
+    uint32_t v = painter_get_view_key(painter, PAINT_CACHE_MAX_ERR);
+    #define H(a) v = crc32(v, (const void*)&(a), sizeof(a))
+    H(painter->color);
+    H(painter->fb_size);
+    H(painter->pixel_scale);
+    H(painter->flags);
+    H(painter->contrast);
+    // Hash the textures by url when we can, so that a texture created
+    // again for the same image doesn't invalidate the cache.
+    for (i = 0; i < ARRAY_SIZE(painter->textures); i++) {
+        tex = painter->textures[i].tex;
+        if (!tex) continue;
+        H(i);
+        H(painter->textures[i].type);
+        H(painter->textures[i].mat);
+        if (tex->url)
+            v = crc32(v, (const void*)tex->url, strlen(tex->url));
+        else
+            H(tex->id);
+    }
+    H(painter->lines.width);
+    H(painter->lines.glow);
+    H(painter->lines.dash_length);
+    H(painter->lines.dash_ratio);
+    H(painter->lines.fade_dist_min);
+    H(painter->lines.fade_dist_max);
+    #undef H
+    if (data) v = crc32(v, data, size);
+    return v ?: 1;
+}
+
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+static void test_view_key(void)
+{
+    observer_t obs = *core->observer;
+    projection_t proj;
+    painter_t painter = {.obs = &obs, .proj = &proj};
+    double step;
+    uint32_t key, cache_key;
+
+    projection_init(&proj, PROJ_STEREOGRAPHIC, 60 * DD2R, 800, 600);
+    step = PAINT_CACHE_MAX_ERR * proj.fovy / proj.window_size[1] /
+           EARTH_ROT_RATE;
+
+    // Two updates within the same time step give the same key.
+    obj_set_attr((obj_t*)&obs, "tt", (floor(58963.0 / step) + 0.1) * step);
+    observer_update(&obs, false);
+    key = painter_get_view_key(&painter, PAINT_CACHE_MAX_ERR);
+    cache_key = painter_get_cache_key(&painter, NULL, 0);
+    obj_set_attr((obj_t*)&obs, "tt", obs.tt + step * 0.8);
+    observer_update(&obs, false);
+    assert(painter_get_view_key(&painter, PAINT_CACHE_MAX_ERR) == key);
+    assert(painter_get_cache_key(&painter, NULL, 0) == cache_key);
+
+    // But not after the next step.
+    obj_set_attr((obj_t*)&obs, "tt", obs.tt + step);
+    observer_update(&obs, false);
+    assert(painter_get_view_key(&painter, PAINT_CACHE_MAX_ERR) != key);
+}
+
+TEST_REGISTER(NULL, test_view_key, TEST_AUTO);
+
+#endif
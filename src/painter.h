@@ -24,10 +24,14 @@ typedef struct point point_t;
 typedef struct point_3d point_3d_t;
 typedef struct texture texture_t;
 typedef struct renderer renderer_t;
+typedef struct render_list render_list_t;
 
 // Base font size in pixels
 #define FONT_SIZE_BASE 15
 
+// Number of points per side of the viewport polygon.
+#define VIEWPORT_POLYGON_SPLIT 4
+
 /*
  * Enum: ALIGN_FLAGS
  * Alignment values that can be passed to paint_text.
@@ -145,6 +149,11 @@ struct painter
         double viewport_caps[4][4];
         int nb_viewport_caps;
 
+        // Caps built from the edges of the viewport polygon, only used
+        // for the quads clipping test.
+        double polygon_caps[4 * VIEWPORT_POLYGON_SPLIT][4];
+        int nb_polygon_caps;
+
         // Sky above ground cap for fast clipping test.
         // The cap is pointing up, and has an angle of 91 deg (1 deg margin to
         // take refraction into account).
@@ -192,6 +201,47 @@ int paint_prepare(painter_t *painter, double win_w, double win_h,
                   double scale);
 int paint_finish(const painter_t *painter);
 
+/*
+ * Type: paint_cache_t
+ * Retained list of render items, that a module can replay as long as its
+ * key doesn't change.  See <paint_cache_replay>.
+ */
+typedef struct paint_cache {
+    uint32_t        key;
+    render_list_t   *list;
+} paint_cache_t;
+
+/*
+ * Function: paint_cache_replay
+ * Replay the items of a cache if it has been recorded with the same key.
+ *
+ * If this returns false, the caller should render normally between calls
+ * to <paint_cache_record_begin> and <paint_cache_record_end>, e.g:
+ *
+ *   key = painter_get_cache_key(painter, NULL, 0);
+ *   if (!paint_cache_replay(painter, &cache, key)) {
+ *       paint_cache_record_begin(painter);
+ *       // Render using the painter.
+ *       paint_cache_record_end(painter, &cache, key);
+ *   }
+ *
+ * Only the painter calls are recorded, so anything else the rendering
+ * code does (like adding labels) has to be done outside of the cache.
+ */
+bool paint_cache_replay(const painter_t *painter, const paint_cache_t *cache,
+                        uint32_t key);
+
+void paint_cache_record_begin(const painter_t *painter);
+
+void paint_cache_record_end(const painter_t *painter, paint_cache_t *cache,
+                            uint32_t key);
+
+/*
+ * Function: paint_cache_release
+ * Release the memory used by a cache.
+ */
+void paint_cache_release(paint_cache_t *cache);
+
 /*
  * Set the current painter texture.
  *
@@ -369,6 +419,39 @@ void paint_debug(bool value);
 bool painter_is_quad_clipped(const painter_t *painter, int frame,
                              const uv_map_t *map);
 
+/*
+ * Function: painter_get_view_key
+ * Compute a key identifying the current view and projection.
+ *
+ * The time is quantized so that the sky rotation during one step stays
+ * below a given error, so that we can reuse values computed for a given
+ * view across frames.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   max_err    - Max error allowed (in window pixels).
+ *
+ * Return:
+ *   A non zero key.
+ */
+uint32_t painter_get_view_key(const painter_t *painter, double max_err);
+
+/*
+ * Function: painter_get_cache_key
+ * Compute a key identifying the view and the painter state, for use
+ * with <paint_cache_replay>.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   data       - Extra data to add to the key (can be NULL).
+ *   size       - Size of the extra data.
+ *
+ * Return:
+ *   A non zero key.
+ */
+uint32_t painter_get_cache_key(const painter_t *painter,
+                               const void *data, int size);
+
 
 // Function: painter_is_healpix_clipped
 //
@@ -389,6 +472,29 @@ bool painter_is_quad_clipped(const painter_t *painter, int frame,
 bool painter_is_healpix_clipped(const painter_t *painter, int frame,
                                 int order, int pix);
 
+/*
+ * Function: painter_get_quad_split
+ * Compute the number of divisions needed to render a mapped quad.
+ *
+ * We project a 3x3 grid of the quad and measure how far the middle points
+ * are from the interpolation of the projected corners, then use the fact
+ * that the error decreases with the square of the split to get the split
+ * needed to stay under a given screen space error.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   frame      - One of the <FRAME> enum frame.
+ *   map        - The mapping function from UV to the 3D space.
+ *   max_split  - Max split value (power of two).
+ *   max_err    - Max allowed error in window pixels.
+ *
+ * Returns:
+ *   A power of two between 1 and max_split.
+ */
+int painter_get_quad_split(const painter_t *painter, int frame,
+                           const uv_map_t *map, int max_split,
+                           double max_err);
+
 /*
  * Function: painter_is_planet_healpix_clipped
  * Check if a healpix pixel on the surface of a planet is clipped.
@@ -554,6 +660,21 @@ int paint_2d_rect(const painter_t *painter, const double transf[3][3],
 int paint_2d_line(const painter_t *painter, const double transf[3][3],
                   const double p1[2], const double p2[2]);
 
+/*
+ * Function: paint_2d_lines
+ * Paint a batch of segments in 2d.
+ *
+ * Contrary to <paint_2d_line>, the segments of consecutive calls are
+ * merged into a single draw call.
+ *
+ * Parameters:
+ *   painter    - The painter.
+ *   n          - Number of segments.
+ *   lines      - Start and end pos of each segment, in window coordinates.
+ */
+int paint_2d_lines(const painter_t *painter, int n,
+                   const double (*lines)[2][2]);
+
 
 /*
  * Function: paint_cap
@@ -631,4 +752,27 @@ bool painter_project(const painter_t *painter, int frame, const double pos[3],
 bool painter_unproject(const painter_t *painter, int frame,
                      const double win_pos[2], double pos[3]);
 
+/*
+ * Function: painter_unproject_n
+ * Unproject an array of 2D points defined on the screen.
+ *
+ * Same as <painter_unproject> for each point, but faster.
+ *
+ * Returns:
+ *   False if any of the points cannot be unprojected.
+ */
+bool painter_unproject_n(const painter_t *painter, int frame, int n,
+                         const double (*win_pos)[2], double (*pos)[3]);
+
+/*
+ * Function: painter_get_clip_stats
+ * Get statistics about the quads clipping tests of the current frame.
+ *
+ * Parameters:
+ *   nb_tested              - Number of quads tested.
+ *   nb_culled_by_polygon   - Number of quads that have been culled only by
+ *                            the viewport polygon edge caps.
+ */
+void painter_get_clip_stats(int *nb_tested, int *nb_culled_by_polygon);
+
 #endif // PAINTER_H
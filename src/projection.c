@@ -9,11 +9,14 @@
 
 #include "projection.h"
 
+#include "log.h"
+#include "system.h"
 #include "tests.h"
 #include "utils/vec.h"
 
 #include <assert.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -83,16 +86,194 @@ bool project_to_win_xy(const projection_t *proj, const double input[3],
     return true;
 }
 
+// Apply the non linear part of the projection to an array of points.
+static void project_n(const projection_t *proj, int n,
+                      const double (*input)[3], double (*out)[3])
+{
+    int i;
+    if (proj->klass->project_n) {
+        proj->klass->project_n(n, input, out);
+        return;
+    }
+    for (i = 0; i < n; i++)
+        proj->klass->project(input[i], out[i]);
+}
+
+bool project_to_win_n(const projection_t *proj, int n,
+                      const double (*input)[3], double (*out)[3])
+{
+    int i;
+    bool ret = true;
+    double x, y, z, k;
+    const double (*m)[4] = proj->mat;
+    const double w = proj->window_size[0];
+    const double h = proj->window_size[1];
+
+    project_n(proj, n, input, out);
+    // Same computation as in project_to_win, with the matrix product
+    // unrolled so that the compiler can vectorize the loop.
+    for (i = 0; i < n; i++) {
+        x = out[i][0];
+        y = out[i][1];
+        z = out[i][2];
+        k = m[0][3] * x + m[1][3] * y + m[2][3] * z + m[3][3];
+        if (!k) {
+            vec3_set(out[i], 0, 0, 0);
+            ret = false;
+            continue;
+        }
+        k = 1.0 / k;
+        out[i][0] = (+(m[0][0] * x + m[1][0] * y + m[2][0] * z + m[3][0]) * k
+                     + 1) / 2 * w;
+        out[i][1] = (-(m[0][1] * x + m[1][1] * y + m[2][1] * z + m[3][1]) * k
+                     + 1) / 2 * h;
+        out[i][2] = ((m[0][2] * x + m[1][2] * y + m[2][2] * z + m[3][2]) * k
+                     + 1) / 2;
+    }
+    return ret;
+}
+
+void project_to_clip_n(const projection_t *proj, int n,
+                       const double (*input)[3], double (*out)[4])
+{
+    int i, j, size;
+    double buf[64][3], p[4];
+
+    for (i = 0; i < n; i += 64) {
+        size = (n - i < 64) ? n - i : 64;
+        project_n(proj, size, input + i, buf);
+        for (j = 0; j < size; j++) {
+            vec4_set(p, buf[j][0], buf[j][1], buf[j][2], 1.0);
+            mat4_mul_vec4(proj->mat, p, out[i + j]);
+        }
+    }
+}
+
 bool unproject(const projection_t *proj,
                const double v[3], double out[3])
+{
+    return unproject_n(proj, 1, (const double (*)[3])v, (double (*)[3])out);
+}
+
+bool unproject_n(const projection_t *proj, int n,
+                 const double (*v)[3], double (*out)[3])
 {
     double p[4], inv[4][4];
+    int i;
+    bool ret = true;
+
     assert(proj->klass->backward);
-    p[0] = v[0] / proj->window_size[0] * 2 - 1;
-    p[1] = 1 - v[1] / proj->window_size[1] * 2;
-    p[2] = 2 * v[2] - 1;
-    p[3] = 1;
     if (!mat4_invert(proj->mat, inv)) assert(false);
-    mat4_mul_vec4(inv, p, p);
-    return proj->klass->backward(p, out);
+    for (i = 0; i < n; i++) {
+        p[0] = v[i][0] / proj->window_size[0] * 2 - 1;
+        p[1] = 1 - v[i][1] / proj->window_size[1] * 2;
+        p[2] = 2 * v[i][2] - 1;
+        p[3] = 1;
+        mat4_mul_vec4(inv, p, p);
+        ret = proj->klass->backward(p, out[i]) && ret;
+    }
+    return ret;
 }
+
+/******** TESTS ***********************************************************/
+
+#if COMPILE_TESTS
+
+// Generate points evenly distributed on the sphere, at various distances.
+static void test_gen_points(int n, double (*out)[3])
+{
+    int i;
+    double z, r, a;
+    for (i = 0; i < n; i++) {
+        z = 1 - 2 * (i + 0.5) / n;
+        r = sqrt(1 - z * z);
+        a = i * M_PI * (3 - sqrt(5));
+        vec3_set(out[i], r * cos(a), r * sin(a), z);
+        vec3_mul(1.0 + (i % 7), out[i], out[i]);
+    }
+}
+
+static void test_projections_batch(void)
+{
+    const int n = 1000;
+    int type, i;
+    bool ok;
+    projection_t proj;
+    double (*input)[3], (*win)[3], (*clip)[4], p[4];
+
+    input = calloc(n, sizeof(*input));
+    win = calloc(n, sizeof(*win));
+    clip = calloc(n, sizeof(*clip));
+    test_gen_points(n, input);
+
+    for (type = PROJ_PERSPECTIVE; type < PROJ_COUNT; type++) {
+        projection_init(&proj, type, 60 * DD2R, 800, 600);
+        ok = project_to_win_n(&proj, n, input, win);
+        project_to_clip_n(&proj, n, input, clip);
+        for (i = 0; i < n; i++) {
+            if (project_to_win(&proj, input[i], p))
+                assert(vec3_dist(p, win[i]) < 1e-9 * (1 + vec3_norm(p)));
+            else
+                assert(!ok);
+            project_to_clip(&proj, input[i], p);
+            assert(fabs(p[0] - clip[i][0]) < 1e-12 * (1 + fabs(p[0])));
+            assert(fabs(p[3] - clip[i][3]) < 1e-12 * (1 + fabs(p[3])));
+        }
+        // Check that we get back the input points.  Hammer and mercator
+        // don't have a projection matrix yet.
+        if (type != PROJ_HAMMER && type != PROJ_MERCATOR) {
+            unproject_n(&proj, n, win, win);
+            for (i = 0; i < n; i++) {
+                vec3_normalize(input[i], p);
+                if (p[2] > -0.1) continue; // Only check points in front.
+                vec3_normalize(win[i], win[i]);
+                assert(vec3_dist(p, win[i]) < 1e-9);
+            }
+            project_to_win_n(&proj, n, input, win);
+        }
+
+        // Also check in place projection.
+        project_to_win_n(&proj, n, input, input);
+        for (i = 0; i < n; i++)
+            assert(vec3_dist(input[i], win[i]) == 0);
+        test_gen_points(n, input);
+    }
+
+    free(input);
+    free(win);
+    free(clip);
+}
+
+// Not run automatically.  Compare the speed of the batch and single point
+// functions, with tests_run("projection").
+static void test_projections_bench(void)
+{
+    const int n = 1000000;
+    int type, i;
+    projection_t proj;
+    double (*input)[3], (*win)[3], t0, t1, t2;
+
+    input = calloc(n, sizeof(*input));
+    win = calloc(n, sizeof(*win));
+    test_gen_points(n, input);
+
+    for (type = PROJ_PERSPECTIVE; type < PROJ_COUNT; type++) {
+        projection_init(&proj, type, 60 * DD2R, 800, 600);
+        t0 = sys_get_unix_time();
+        for (i = 0; i < n; i++)
+            project_to_win(&proj, input[i], win[i]);
+        t1 = sys_get_unix_time();
+        project_to_win_n(&proj, n, input, win);
+        t2 = sys_get_unix_time();
+        LOG_I("%-15s %6.1f Mpoints/s (single) %6.1f Mpoints/s (batch)",
+              proj.klass->name, n / (t1 - t0) / 1e6, n / (t2 - t1) / 1e6);
+    }
+
+    free(input);
+    free(win);
+}
+
+TEST_REGISTER(NULL, test_projections_batch, TEST_AUTO);
+TEST_REGISTER(NULL, test_projections_bench, 0);
+
+#endif
@@ -80,6 +80,11 @@ struct projection_klass
      * by the projection 4x4 matrix to get the clipping space coordinates.
      */
     bool (*project)(const double v[S 3], double out[S 3]);
+    /*
+     * Batch version of project, used by <project_to_win_n> and
+     * <project_to_clip_n>.  The input and output arrays can be the same.
+     */
+    void (*project_n)(int n, const double (*v)[3], double (*out)[3]);
     bool (*backward)(const double v[S 3], double out[S 3]);
     void (*compute_fovs)(int proj_type, double fov, double aspect,
                          double *fovx, double *fovy);
@@ -151,6 +156,36 @@ bool project_to_win_xy(const projection_t *proj, const double input[S 3],
 bool project_to_clip(const projection_t *proj, const double input[S 3],
                      double out[S 4]);
 
+/*
+ * Function: project_to_win_n
+ * Project an array of points from view coordinates to windows coordinates.
+ *
+ * Same as calling <project_to_win> on each point, but much faster for
+ * large arrays.  The input and output can be the same array.
+ *
+ * Parameters:
+ *   proj   - A projection.
+ *   n      - Number of points.
+ *   input  - Input xyz coordinates, in view space.
+ *   out    - Output xyz coordinates, in window space.  The points that
+ *            cannot be projected are set to zero.
+ *
+ * Return:
+ *   False if any of the points could not be projected.
+ */
+bool project_to_win_n(const projection_t *proj, int n,
+                      const double (*input)[3], double (*out)[3]);
+
+/*
+ * Function: project_to_clip_n
+ * Project an array of points from view coordinates to clip space.
+ *
+ * Same as calling <project_to_clip> on each point.  The input and output
+ * arrays must not overlap.
+ */
+void project_to_clip_n(const projection_t *proj, int n,
+                       const double (*input)[3], double (*out)[4]);
+
 /*
  * Function: unproject
  * Compute a backward projection
@@ -166,6 +201,19 @@ bool project_to_clip(const projection_t *proj, const double input[S 3],
 bool unproject(const projection_t *proj,
                const double v[S 3], double out[S 3]);
 
+/*
+ * Function: unproject_n
+ * Compute the backward projection of an array of points.
+ *
+ * Same as calling <unproject> on each point, but the projection matrix is
+ * only inverted once.  The input and output can be the same array.
+ *
+ * Return:
+ *   True if all the points could be unprojected.
+ */
+bool unproject_n(const projection_t *proj, int n,
+                 const double (*v)[3], double (*out)[3]);
+
 #undef S
 
 #endif // PROJECTION_H
@@ -26,6 +26,15 @@ static bool proj_hammer_project(const double v[3], double out[3])
     return true;
 }
 
+// Batch projection, with the per point function inlined in the loop.
+static void proj_hammer_project_n(int n, const double (*v)[3],
+                                  double (*out)[3])
+{
+    int i;
+    for (i = 0; i < n; i++)
+        proj_hammer_project(v[i], out[i]);
+}
+
 static bool proj_hammer_backward(const double v[3], double out[3])
 {
     double p[3] = {0}, zsq, z, alpha, delta, cd;
@@ -56,6 +65,7 @@ static const projection_klass_t proj_hammer_klass = {
     .max_ui_fov             = 360 * DD2R,
     .init                   = proj_hammer_init,
     .project                = proj_hammer_project,
+    .project_n              = proj_hammer_project_n,
     .backward               = proj_hammer_backward,
 };
 PROJECTION_REGISTER(proj_hammer_klass);
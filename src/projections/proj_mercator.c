@@ -33,6 +33,15 @@ static bool proj_mercator_project(const double v[3], double out[3])
     return true;
 }
 
+// Batch projection, see projection_klass_t.
+static void proj_mercator_project_n(int n, const double (*v)[3],
+                                    double (*out)[3])
+{
+    int i;
+    for (i = 0; i < n; i++)
+        proj_mercator_project(v[i], out[i]);
+}
+
 static bool proj_mercator_backward(const double v[3], double out[3])
 {
     double e, h, h1, sin_delta, cos_delta;
@@ -67,6 +76,7 @@ static const projection_klass_t proj_mercator_klass = {
     .max_ui_fov             = 175.0 * DD2R,
     .init                   = proj_mercator_init,
     .project                = proj_mercator_project,
+    .project_n              = proj_mercator_project_n,
     .backward               = proj_mercator_backward,
 };
 PROJECTION_REGISTER(proj_mercator_klass);
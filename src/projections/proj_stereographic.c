@@ -57,6 +57,29 @@ static bool proj_stereographic_project(const double v[3], double out[3])
     return true;
 }
 
+/*
+ * Same as proj_stereographic_project, without branches in the loop so that
+ * the compiler can vectorize it.
+ */
+static void proj_stereographic_project_n(int n, const double (*v)[3],
+                                         double (*out)[3])
+{
+    int i;
+    double x, y, z, d, k;
+    for (i = 0; i < n; i++) {
+        d = sqrt(v[i][0] * v[i][0] + v[i][1] * v[i][1] + v[i][2] * v[i][2]);
+        k = 1.0 / d;
+        x = v[i][0] * k;
+        y = v[i][1] * k;
+        z = v[i][2] * k;
+        // Discontinuity case: set all to zero.
+        k = (z == 1.0) ? 0.0 : 1.0 / (0.5 * (1.0 - z)) * d;
+        out[i][0] = x * k;
+        out[i][1] = y * k;
+        out[i][2] = (z == 1.0) ? 0.0 : -d;
+    }
+}
+
 static bool proj_stereographic_backward(const double v[3], double out[3])
 {
     double lqq;
@@ -94,6 +117,7 @@ static const projection_klass_t proj_stereographic_klass = {
     .max_ui_fov     = 185. * DD2R,
     .init           = proj_stereographic_init,
     .project        = proj_stereographic_project,
+    .project_n      = proj_stereographic_project_n,
     .backward       = proj_stereographic_backward,
     .compute_fovs   = proj_stereographic_compute_fov,
 };
@@ -16,6 +16,7 @@
 
 
 typedef struct renderer renderer_t;
+typedef struct render_list render_list_t;
 typedef struct painter painter_t;
 typedef struct point point_t;
 typedef struct point_3d point_3d_t;
@@ -35,6 +36,51 @@ void render_prepare(renderer_t *rend,
 
 void render_finish(renderer_t *rend);
 
+/*
+ * Function: render_record_begin
+ * Start to record the render items added to the renderer into a list.
+ */
+void render_record_begin(renderer_t *rend);
+
+/*
+ * Function: render_record_end
+ * Stop the recording started with <render_record_begin>.
+ *
+ * The items are still rendered normally for this frame.
+ *
+ * Return:
+ *   A copy of all the items added since the recording started, or NULL if
+ *   they cannot be copied.
+ */
+render_list_t *render_record_end(renderer_t *rend);
+
+/*
+ * Function: render_replay
+ * Add a copy of all the items of a recorded list to the renderer.
+ */
+void render_replay(renderer_t *rend, const render_list_t *list);
+
+/*
+ * Function: render_list_delete
+ * Delete a recorded list.  Accept NULL.
+ */
+void render_list_delete(render_list_t *list);
+
+/*
+ * Function: render_get_lists_stats
+ * Return the number of lists replayed and recorded during the last frame.
+ */
+void render_get_lists_stats(const renderer_t *rend,
+                            int *nb_replayed, int *nb_recorded);
+
+/*
+ * Function: render_get_nb_items_flushed
+ * Return the number of render items sent to the GPU by the last flush.
+ *
+ * Each item is roughly one draw call.
+ */
+int render_get_nb_items_flushed(const renderer_t *rend);
+
 void render_points_2d(renderer_t *rend, const painter_t *painter,
                       int n, const point_t *points);
 
@@ -60,8 +106,9 @@ void render_line(renderer_t *rend, const painter_t *painter,
 
 void render_mesh(renderer_t *rend, const painter_t *painter,
                  int frame, int mode, int verts_count,
-                 const double verts[][3], int indices_count,
-                 const uint16_t indices[], bool use_stencil);
+                 const double verts[][3], const uint8_t colors[][4],
+                 int indices_count, const uint16_t indices[],
+                 bool use_stencil);
 
 void render_ellipse_2d(renderer_t *rend, const painter_t *painter,
                        const double pos[2], const double size[2],
@@ -74,6 +121,17 @@ void render_rect_2d(renderer_t *rend, const painter_t *painter,
 void render_line_2d(renderer_t *rend, const painter_t *painter,
                     const double p1[2], const double p2[2]);
 
+/*
+ * Function: render_lines_2d
+ * Render a batch of window space segments with the painter color and
+ * line width.  The edges of the segments are antialiased.
+ *
+ * Contrary to <render_line_2d>, consecutive calls are merged into a single
+ * draw call as long as the painter flags don't change.
+ */
+void render_lines_2d(renderer_t *rend, const painter_t *painter,
+                     int n, const double (*lines)[2][2]);
+
 void render_model_3d(renderer_t *rend, const painter_t *painter,
                      const char *model, const double model_mat[4][4],
                      const double view_mat[4][4], const double proj_mat[4][4],
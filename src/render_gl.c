@@ -25,6 +25,8 @@
 #include <float.h>
 
 #define GRID_CACHE_SIZE (2 * (1 << 20))
+// Max number of text layouts we keep in cache.
+#define TEXT_CACHE_SIZE 8192
 
 // Fix GL_PROGRAM_POINT_SIZE support on Mac.
 #ifdef __APPLE__
@@ -94,6 +96,7 @@ enum {
     ITEM_VG_LINE,
     ITEM_TEXT,
     ITEM_GLTF,
+    ITEM_LINES_2D,
 };
 
 typedef struct item item_t;
@@ -269,6 +272,13 @@ static const gl_buf_info_t FOG_BUF = {
     },
 };
 
+// A retained list of render items, that we can replay at later frames.
+struct render_list {
+    item_t  *items;
+    double  depth_min;
+    double  depth_max;
+};
+
 struct renderer {
 
     projection_t proj;
@@ -291,7 +301,22 @@ struct renderer {
 
     item_t  *items;
     cache_t *grid_cache;
+    cache_t *text_cache;
 
+    // Render lists recording state.
+    struct {
+        bool    active;
+        item_t  *start; // Last item before the recording started.
+        double  depth_min;
+        double  depth_max;
+    } record;
+    // Last item we can't batch new items with.
+    item_t  *barrier;
+    // Number of lists replayed or recorded during the frame.
+    int     nb_lists_replayed;
+    int     nb_lists_recorded;
+    // Number of items sent to the GPU by the last flush.
+    int     nb_items_flushed;
 };
 
 // Weak linking, so that we can put the implementation in a module.
@@ -379,6 +404,9 @@ void render_prepare(renderer_t *rend, const projection_t *proj,
 
     rend->depth_min = DBL_MAX;
     rend->depth_max = DBL_MIN;
+    rend->barrier = NULL;
+    rend->nb_lists_replayed = 0;
+    rend->nb_lists_recorded = 0;
 }
 
 /*
@@ -398,7 +426,7 @@ static item_t *get_item(renderer_t *rend, int type,
     item_t *item;
     item = rend->items ? rend->items->prev : NULL;
 
-    while (item) {
+    while (item && item != rend->barrier) {
         if (item->type == type &&
             item->buf.capacity > item->buf.nb + buf_size &&
             (indices_size == 0 ||
@@ -999,31 +1027,90 @@ static void text_using_texture(renderer_t *rend,
     texture_2d(rend, tex, uv, verts, view_pos, VEC(1, 1, 1, color[3]), flags);
 }
 
+static float get_nvg_text_spacing(float size, int effects)
+{
+    if (sys_lang_supports_spacing() && effects & TEXT_SEMI_SPACED)
+        return size * 0.075;
+    if (sys_lang_supports_spacing() && effects & TEXT_SPACED)
+        return size * 0.308;
+    return size * 0.01;
+}
+
 static void set_nvg_text_settings(
         renderer_t *rend, int font, float size, int effects)
 {
     nvgFontFaceId(rend->vg, rend->fonts[font].id);
     nvgFontSize(rend->vg, size);
-    nvgTextLetterSpacing(rend->vg, size * 0.01);
-    if (sys_lang_supports_spacing() && effects & TEXT_SPACED)
-        nvgTextLetterSpacing(rend->vg, size * 0.308);
-    if (sys_lang_supports_spacing() && effects & TEXT_SEMI_SPACED)
-        nvgTextLetterSpacing(rend->vg, size * 0.075);
+    nvgTextLetterSpacing(rend->vg, get_nvg_text_spacing(size, effects));
 }
 
-static void get_nvg_text_bounds(
-        renderer_t *rend, const char* text, int align,
-        const double pos[2], double bounds[4])
+// Unaligned metrics of a text, as computed by nanovg.
+typedef struct {
+    float bounds[4];
+    float descender;
+} text_layout_t;
+
+static int text_layout_del(void *data)
 {
-    float w, h, descender, fbounds[4];
+    free(data);
+    return 0;
+}
 
+static int text_layout_filter_all(void *data, void *user)
+{
+    return 1;
+}
+
+/*
+ * Return the layout of a text, using the cache if possible.
+ *
+ * The nanovg text settings are the one passed as argument, so that the
+ * layout can be computed from both the bounds and the render functions.
+ */
+static const text_layout_t *get_text_layout(
+        renderer_t *rend, const char *text, int font, float size,
+        int effects)
+{
+    text_layout_t *layout;
+    struct {
+        char    text[128];
+        int     font;
+        float   size;
+        float   spacing;
+    } key;
+
+    memset(&key, 0, sizeof(key));
+    snprintf(key.text, sizeof(key.text), "%s", text);
+    key.font = rend->fonts[font].id;
+    key.size = size;
+    key.spacing = get_nvg_text_spacing(size, effects);
+
+    if (!rend->text_cache)
+        rend->text_cache = cache_create(TEXT_CACHE_SIZE, 1);
+    layout = cache_get(rend->text_cache, &key, sizeof(key));
+    if (layout) return layout;
+
+    layout = calloc(1, sizeof(*layout));
     nvgSave(rend->vg);
-    // First determine the actual text block width
+    set_nvg_text_settings(rend, font, size, effects);
     nvgTextAlign(rend->vg, NVG_ALIGN_TOP | NVG_ALIGN_LEFT);
-    nvgTextBoxBounds(rend->vg, 0, 0, 10000, text, NULL, fbounds);
+    nvgTextBoxBounds(rend->vg, 0, 0, 10000, text, NULL, layout->bounds);
+    nvgTextMetrics(rend->vg, NULL, &layout->descender, NULL);
+    nvgRestore(rend->vg);
+    cache_add(rend->text_cache, &key, sizeof(key), layout, 1,
+              text_layout_del);
+    return layout;
+}
+
+static void get_nvg_text_bounds(
+        const text_layout_t *layout, int align,
+        const double pos[2], double bounds[4])
+{
+    float w, h, descender, fbounds[4];
 
     // Compute bounds taking alignment into account.
-    nvgTextMetrics(rend->vg, NULL, &descender, NULL);
+    memcpy(fbounds, layout->bounds, sizeof(fbounds));
+    descender = layout->descender;
     fbounds[0] = floorf(fbounds[0]);
     // Artificially adds a margin equals to "descender" above the top of the
     // font to get something closer to the Qt renderer.
@@ -1041,7 +1128,6 @@ static void get_nvg_text_bounds(
     bounds[1] = floor(fbounds[1] + pos[1]);
     bounds[2] = bounds[0] + w;
     bounds[3] = bounds[1] + h;
-    nvgRestore(rend->vg);
 }
 
 // Render text using nanovg.
@@ -1092,10 +1178,8 @@ static void text_using_nanovg(renderer_t *rend,
             snprintf(buf, sizeof(buf), "%s", text);
         }
 
-        nvgSave(rend->vg);
-        set_nvg_text_settings(rend, font, size, effects);
-        get_nvg_text_bounds(rend, buf, align, pos, bounds);
-        nvgRestore(rend->vg);
+        get_nvg_text_bounds(get_text_layout(rend, buf, font, size, effects),
+                            align, pos, bounds);
 
         // Uncomment to see labels bounding box
         if ((0)) {
@@ -1308,6 +1392,23 @@ static void item_mesh_render(renderer_t *rend, const item_t *item)
     }
 }
 
+static void item_lines_2d_render(renderer_t *rend, const item_t *item)
+{
+    gl_shader_t *shader;
+    shader_define_t defines[] = {
+        {"PROJ", 0},
+        {}
+    };
+    shader = shader_get("mesh", defines, ATTR_NAMES, init_shader);
+    GL(glUseProgram(shader->prog));
+    GL(glDisable(GL_CULL_FACE));
+    GL(glDisable(GL_DEPTH_TEST));
+    GL(glEnable(GL_BLEND));
+    GL(glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA,
+                           GL_ZERO, GL_ONE));
+    draw_buffer(&item->buf, &item->indices, GL_TRIANGLES);
+}
+
 // XXX: almost the same as item_mesh_render!
 static void item_lines_render(renderer_t *rend, const item_t *item)
 {
@@ -1351,11 +1452,27 @@ static void item_lines_render(renderer_t *rend, const item_t *item)
     GL(glDisable(GL_DEPTH_TEST));
 }
 
-static void item_vg_render(renderer_t *rend, const item_t *item)
+static bool is_vg_item(const item_t *item)
+{
+    return item && (item->type == ITEM_VG_ELLIPSE ||
+                     item->type == ITEM_VG_RECT ||
+                     item->type == ITEM_VG_LINE);
+}
+
+/*
+ * Render a 2d vector item.
+ *
+ * Consecutive vector items are rendered into a single nanovg frame, so
+ * that a run of symbols is only flushed once to OpenGL.
+ */
+static void item_vg_render(renderer_t *rend, const item_t *item,
+                           bool first, bool last)
 {
     double a, da;
-    nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
-                            rend->fb_size[1] / rend->scale, rend->scale);
+    if (first) {
+        nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
+                                rend->fb_size[1] / rend->scale, rend->scale);
+    }
     nvgSave(rend->vg);
     nvgTranslate(rend->vg, item->vg.pos[0], item->vg.pos[1]);
     nvgRotate(rend->vg, item->vg.angle);
@@ -1391,6 +1508,7 @@ static void item_vg_render(renderer_t *rend, const item_t *item)
     nvgStrokeWidth(rend->vg, item->vg.stroke_width);
     nvgStroke(rend->vg);
     nvgRestore(rend->vg);
+    if (!last) return;
     nvgEndFrame(rend->vg);
 
     // Reset colormask to its original value.
@@ -1401,9 +1519,9 @@ static void item_text_render(renderer_t *rend, const item_t *item)
 {
     int font = (item->text.effects & TEXT_BOLD) ? FONT_BOLD : FONT_REGULAR;
     double pos[2] = {0, 0};
-    float descender;
     float w;
     double bounds[4];
+    const text_layout_t *layout;
 
     nvgBeginFrame(rend->vg, rend->fb_size[0] / rend->scale,
                             rend->fb_size[1] / rend->scale, rend->scale);
@@ -1416,8 +1534,10 @@ static void item_text_render(renderer_t *rend, const item_t *item)
                                    item->color[2] * 255,
                                    item->color[3] * 255));
 
+    layout = get_text_layout(rend, item->text.text, font, item->text.size,
+                             item->text.effects);
     set_nvg_text_settings(rend, font, item->text.size, item->text.effects);
-    get_nvg_text_bounds(rend, item->text.text, item->text.align, pos, bounds);
+    get_nvg_text_bounds(layout, item->text.align, pos, bounds);
     w = bounds[2] - bounds[0];
 
     nvgTextAlign(rend->vg, NVG_ALIGN_TOP |
@@ -1425,11 +1545,10 @@ static void item_text_render(renderer_t *rend, const item_t *item)
                                       NVG_ALIGN_CENTER)));
 
     // Render in multi-line using the previously computed line width
-    nvgTextMetrics(rend->vg, NULL, &descender, NULL);
     // Re-add the "descender" extra offset that was applied on the bounding
     // box to simulate an extra space above the font, so that the font is
     // properly aligned.
-    nvgTextBox(rend->vg, bounds[0], roundf(bounds[1] - descender), w,
+    nvgTextBox(rend->vg, bounds[0], roundf(bounds[1] - layout->descender), w,
             item->text.text, NULL);
 
     // Uncomment to see labels bounding box
@@ -1694,9 +1813,121 @@ static void item_gltf_render(renderer_t *rend, const item_t *item)
                 proj, item->gltf.light_dir, item->gltf.args);
 }
 
+static void item_delete(item_t *item)
+{
+    texture_release(item->tex);
+    if (item->type == ITEM_PLANET)
+        texture_release(item->planet.normalmap);
+    if (item->type == ITEM_GLTF)
+        json_builder_free(item->gltf.args);
+    gl_buf_release(&item->buf);
+    gl_buf_release(&item->indices);
+    free(item);
+}
+
+static item_t *item_copy(const item_t *item)
+{
+    item_t *ret;
+    assert(item->type != ITEM_GLTF);
+    ret = malloc(sizeof(*ret));
+    *ret = *item;
+    ret->next = ret->prev = NULL;
+    if (item->buf.data) {
+        ret->buf.data = malloc(item->buf.capacity * item->buf.info->size);
+        memcpy(ret->buf.data, item->buf.data,
+               item->buf.nb * item->buf.info->size);
+    }
+    if (item->indices.data) {
+        ret->indices.data = malloc(item->indices.capacity *
+                                   item->indices.info->size);
+        memcpy(ret->indices.data, item->indices.data,
+               item->indices.nb * item->indices.info->size);
+    }
+    if (ret->tex) ret->tex->ref++;
+    if (ret->type == ITEM_PLANET && ret->planet.normalmap)
+        ret->planet.normalmap->ref++;
+    return ret;
+}
+
+void render_record_begin(renderer_t *rend)
+{
+    assert(!rend->record.active);
+    rend->record.active = true;
+    rend->record.start = rend->items ? rend->items->prev : NULL;
+    // Don't batch the recorded items with the previous ones.
+    rend->barrier = rend->record.start;
+    rend->record.depth_min = rend->depth_min;
+    rend->record.depth_max = rend->depth_max;
+    rend->depth_min = DBL_MAX;
+    rend->depth_max = DBL_MIN;
+}
+
+render_list_t *render_record_end(renderer_t *rend)
+{
+    render_list_t *list;
+    item_t *item;
+
+    assert(rend->record.active);
+    rend->record.active = false;
+    list = calloc(1, sizeof(*list));
+    list->depth_min = rend->depth_min;
+    list->depth_max = rend->depth_max;
+    rend->depth_min = fmin(rend->depth_min, rend->record.depth_min);
+    rend->depth_max = fmax(rend->depth_max, rend->record.depth_max);
+
+    item = rend->record.start ? rend->record.start->next : rend->items;
+    for (; item; item = item->next) {
+        // We cannot copy the gltf items arguments.
+        if (item->type == ITEM_GLTF) {
+            render_list_delete(list);
+            return NULL;
+        }
+        DL_APPEND(list->items, item_copy(item));
+    }
+    rend->nb_lists_recorded++;
+    return list;
+}
+
+void render_replay(renderer_t *rend, const render_list_t *list)
+{
+    item_t *item;
+    // Don't batch the replayed items with the previous ones, since they
+    // might have been reordered during the recording.
+    rend->barrier = rend->items ? rend->items->prev : NULL;
+    DL_FOREACH(list->items, item)
+        DL_APPEND(rend->items, item_copy(item));
+    rend->depth_min = fmin(rend->depth_min, list->depth_min);
+    rend->depth_max = fmax(rend->depth_max, list->depth_max);
+    rend->nb_lists_replayed++;
+}
+
+void render_list_delete(render_list_t *list)
+{
+    item_t *item, *tmp;
+    if (!list) return;
+    DL_FOREACH_SAFE(list->items, item, tmp) {
+        DL_DELETE(list->items, item);
+        item_delete(item);
+    }
+    free(list);
+}
+
+void render_get_lists_stats(const renderer_t *rend,
+                            int *nb_replayed, int *nb_recorded)
+{
+    *nb_replayed = rend->nb_lists_replayed;
+    *nb_recorded = rend->nb_lists_recorded;
+}
+
+int render_get_nb_items_flushed(const renderer_t *rend)
+{
+    return rend->nb_items_flushed;
+}
+
 static void rend_flush(renderer_t *rend)
 {
     item_t *item, *tmp;
+    bool vg_frame = false; // Set when a nanovg frame is in progress.
 
     // Compute depth range.
     if (rend->depth_min == DBL_MAX) {
@@ -1734,7 +1965,9 @@ static void rend_flush(renderer_t *rend)
     GL(glEnable(GL_POINT_SPRITE));
 #endif
 
+    rend->nb_items_flushed = 0;
     DL_FOREACH_SAFE(rend->items, item, tmp) {
+        rend->nb_items_flushed++;
         switch (item->type) {
         case ITEM_LINES:
             item_lines_render(rend, item);
@@ -1766,7 +1999,8 @@ static void rend_flush(renderer_t *rend)
         case ITEM_VG_ELLIPSE:
         case ITEM_VG_RECT:
         case ITEM_VG_LINE:
-            item_vg_render(rend, item);
+            item_vg_render(rend, item, !vg_frame, !is_vg_item(tmp));
+            vg_frame = is_vg_item(tmp);
             break;
         case ITEM_TEXT:
             item_text_render(rend, item);
@@ -1774,19 +2008,15 @@ static void rend_flush(renderer_t *rend)
         case ITEM_GLTF:
             item_gltf_render(rend, item);
             break;
+        case ITEM_LINES_2D:
+            item_lines_2d_render(rend, item);
+            break;
         default:
             assert(false);
         }
 
         DL_DELETE(rend->items, item);
-        texture_release(item->tex);
-        if (item->type == ITEM_PLANET)
-            texture_release(item->planet.normalmap);
-        if (item->type == ITEM_GLTF)
-            json_builder_free(item->gltf.args);
-        gl_buf_release(&item->buf);
-        gl_buf_release(&item->indices);
-        free(item);
+        item_delete(item);
     }
     // Reset to default OpenGL settings.
     GL(glDepthMask(GL_TRUE));
@@ -1879,12 +2109,13 @@ end:
 
 void render_mesh(renderer_t *rend, const painter_t *painter,
                  int frame, int mode, int verts_count,
-                 const double verts[][3], int indices_count,
-                 const uint16_t indices[], bool use_stencil)
+                 const double verts[][3], const uint8_t colors[][4],
+                 int indices_count, const uint16_t indices[],
+                 bool use_stencil)
 {
-    int i, ofs;
+    int i, j, ofs;
     double pos[4] = {};
-    uint8_t color[4];
+    uint8_t color[4], vcolor[4];
     item_t *item;
 
     color[0] = painter->color[0] * 255;
@@ -1917,7 +2148,13 @@ void render_mesh(renderer_t *rend, const painter_t *painter,
         vec3_normalize(pos, pos);
         convert_frame(painter->obs, frame, FRAME_VIEW, true, pos, pos);
         gl_buf_3f(&item->buf, -1, ATTR_POS, VEC3_SPLIT(pos));
-        gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(color));
+        if (colors) {
+            for (j = 0; j < 4; j++)
+                vcolor[j] = color[j] * colors[i][j] / 255;
+            gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(vcolor));
+        } else {
+            gl_buf_4i(&item->buf, -1, ATTR_COLOR, VEC4_SPLIT(color));
+        }
         gl_buf_next(&item->buf);
     }
 
@@ -1972,6 +2209,72 @@ void render_line_2d(renderer_t *rend, const painter_t *painter,
     DL_APPEND(rend->items, item);
 }
 
+void render_lines_2d(renderer_t *rend, const painter_t *painter,
+                     int n, const double (*lines)[2][2])
+{
+    int i, j, k, ofs;
+    const int MAX_LINES = 4096;
+    const int16_t INDICES[6] = {0, 1, 4, 5, 4, 1};
+    const double AA = 1.0; // Width of the antialiased edges (px).
+    double d[2], w[4], alpha[4], hw, p[2];
+    uint8_t color[4];
+    item_t *item;
+
+    for (i = 0; i < 4; i++) color[i] = painter->color[i] * 255;
+    if (!color[3] || n <= 0) return;
+    // Indices are 16 bits, so we split very large batches.
+    if (n > MAX_LINES) {
+        render_lines_2d(rend, painter, MAX_LINES, lines);
+        render_lines_2d(rend, painter, n - MAX_LINES, lines + MAX_LINES);
+        return;
+    }
+
+    item = get_item(rend, ITEM_LINES_2D, n * 8, n * 18, NULL);
+    if (item && item->flags != painter->flags) item = NULL;
+    if (!item) {
+        item = calloc(1, sizeof(*item));
+        item->type = ITEM_LINES_2D;
+        item->flags = painter->flags;
+        gl_buf_alloc(&item->buf, &MESH_BUF, MAX_LINES * 8 + 8);
+        gl_buf_alloc(&item->indices, &INDICES_BUF, MAX_LINES * 18 + 18);
+        DL_APPEND(rend->items, item);
+    }
+
+    // Each segment is rendered as three quads across the line: a core of
+    // the painter line width, and on each side a strip of AA pixels whose
+    // alpha fades to zero.  For lines thinner than AA we lower the core
+    // alpha so that the line keeps the same total intensity.
+    hw = painter->lines.width / 2;
+    w[0] = hw + AA / 2;
+    w[1] = fmax(hw - AA / 2, 0);
+    w[2] = -w[1];
+    w[3] = -w[0];
+    alpha[0] = alpha[3] = 0;
+    alpha[1] = alpha[2] = fmin(1, 2 * hw / (w[0] + w[1]));
+
+    for (i = 0; i < n; i++) {
+        ofs = item->buf.nb;
+        vec2_sub(lines[i][1], lines[i][0], d);
+        if (vec2_norm2(d) == 0) continue;
+        vec2_normalize(d, d);
+        for (j = 0; j < 8; j++) {
+            p[0] = lines[i][j / 4][0] + d[1] * w[j % 4];
+            p[1] = lines[i][j / 4][1] - d[0] * w[j % 4];
+            window_to_ndc(rend, p, p);
+            gl_buf_3f(&item->buf, -1, ATTR_POS, p[0], p[1], 0);
+            gl_buf_4i(&item->buf, -1, ATTR_COLOR, color[0], color[1],
+                      color[2], color[3] * alpha[j % 4]);
+            gl_buf_next(&item->buf);
+        }
+        for (k = 0; k < 3; k++) {
+            for (j = 0; j < 6; j++) {
+                gl_buf_1i(&item->indices, -1, 0, ofs + k + INDICES[j]);
+                gl_buf_next(&item->indices);
+            }
+        }
+    }
+}
+
 static void get_model_depth_range(
         const painter_t *painter, const char *model,
         const double model_mat[4][4], const double view_mat[4][4],
@@ -2084,6 +2387,9 @@ void core_add_font(renderer_t *rend, const char *name,
     } else {
         nvgAddFallbackFontId(rend->vg, rend->fonts[font].id, id);
     }
+    // The new font can change the layout of the texts already cached.
+    if (rend->text_cache)
+        cache_evict(rend->text_cache, text_layout_filter_all, NULL);
 }
 
 static void set_default_fonts(renderer_t *rend)
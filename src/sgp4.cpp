@@ -65,6 +65,13 @@ int sgp4(sgp4_elsetrec_t *satrec, double utc_mjd, double r[3], double v[3])
     return elrec->error;
 }
 
+sgp4_elsetrec_t *sgp4_copy(const sgp4_elsetrec_t *satrec)
+{
+    elsetrec *ret = (elsetrec*)malloc(sizeof(*ret));
+    *ret = *(const elsetrec*)satrec;
+    return (sgp4_elsetrec*)ret;
+}
+
 /*
  * Function: sgp4_get_satepoch
  * Return the reference epoch of a sat (UTC MJD)
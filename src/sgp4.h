@@ -33,6 +33,15 @@ sgp4_elsetrec_t *sgp4_twoline2rv(
  */
 int sgp4(sgp4_elsetrec_t *satrec, double utc_mjd, double r[3], double v[3]);
 
+/*
+ * Function: sgp4_copy
+ * Return a newly allocated copy of a satellite orbit elements.
+ *
+ * Since <sgp4> modifies the elements, this can be used to compute
+ * positions from an other thread.  Free the copy with free.
+ */
+sgp4_elsetrec_t *sgp4_copy(const sgp4_elsetrec_t *satrec);
+
 /*
  * Function: sgp4_get_satepoch
  * Return the reference epoch of a sat (UTC MJD)
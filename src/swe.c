@@ -449,6 +449,12 @@ static void test_u8(void)
     assert(strcmp(buf, "A") == 0);
     u8_upper(buf, "aā", 2);
     assert(strcmp(buf, "A") == 0);
+
+    // Ascii characters around the letters are left untouched.
+    u8_upper(buf, "@[`{ç", sizeof(buf));
+    assert(strcmp(buf, "@[`{Ç") == 0);
+    u8_lower(buf, "@[`{Ç", sizeof(buf));
+    assert(strcmp(buf, "@[`{ç") == 0);
 }
 
 TEST_REGISTER(NULL, test_ephemeris, TEST_AUTO);
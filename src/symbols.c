@@ -11,36 +11,99 @@
 
 static texture_t *g_tex = NULL;
 
-static void glc_paint(const painter_t *painter, const double transf[3][3]);
-static void opc_paint(const painter_t *painter, const double transf[3][3]);
-static void cls_paint(const painter_t *painter, const double transf[3][3]);
-static void   g_paint(const painter_t *painter, const double transf[3][3]);
-static void  pn_paint(const painter_t *painter, const double transf[3][3]);
-static void ism_paint(const painter_t *painter, const double transf[3][3]);
-static void bne_paint(const painter_t *painter, const double transf[3][3]);
-static void msh_paint(const painter_t *painter, const double transf[3][3]);
+/*
+ * The procedural symbols are defined as a list of primitives in a unit
+ * space, where the symbol covers the [-1, +1] range.  At render time the
+ * primitives of all the symbols are tesselated into window space segments
+ * that go into a single batched lines item.
+ */
+enum {
+    PRIM_ELLIPSE = 1,
+    PRIM_RECT,
+    PRIM_LINE,
+};
+
+typedef struct {
+    int     type;
+    double  scale;      // Scale of ellipses and rects.
+    double  dashes;     // Dashes length in pixel for ellipses, or zero.
+    double  p1[2];      // Lines start and end positions.
+    double  p2[2];
+} prim_t;
+
+static const prim_t OPC_PRIMS[] = {
+    {PRIM_ELLIPSE, 1, M_PI * 12 / 8},
+    {}
+};
+
+static const prim_t CLS_PRIMS[] = {
+    {PRIM_RECT, 1},
+    {PRIM_ELLIPSE, 0.8, M_PI * 12 * 0.8 / 8},
+    {}
+};
+
+static const prim_t G_PRIMS[] = {
+    {PRIM_ELLIPSE, 1},
+    {}
+};
+
+static const prim_t PN_PRIMS[] = {
+    {PRIM_LINE, .p1 = {-1.75, 0}, .p2 = {-1, 0}},
+    {PRIM_LINE, .p1 = {+1, 0}, .p2 = {+1.75, 0}},
+    {PRIM_LINE, .p1 = {0, -1}, .p2 = {0, -1.75}},
+    {PRIM_LINE, .p1 = {0, +1}, .p2 = {0, +1.75}},
+    {PRIM_ELLIPSE, 1},
+    {}
+};
+
+static const prim_t BNE_PRIMS[] = {
+    {PRIM_RECT, 1},
+    {}
+};
+
+static const prim_t GLC_PRIMS[] = {
+    {PRIM_ELLIPSE, 1},
+    {PRIM_LINE, .p1 = {-1, 0}, .p2 = {1, 0}},
+    {PRIM_LINE, .p1 = {0, -1}, .p2 = {0, 1}},
+    {}
+};
+
+// Filled by init_prims, since the rays are randomized.
+static prim_t MSH_PRIMS[8];
 
 // Match the list of svg files in tool/makedata.py.
 // We can probably do better than that.
 static const struct {
-    const char  *id;
-    uint32_t    color;
-    void        (*paint)(const painter_t *painter, const double transf[3][3]);
+    const char      *id;
+    uint32_t        color;
+    const prim_t    *prims;  // Zero terminated, NULL for png symbols.
 } ENTRIES[] = {
     [SYMBOL_ARTIFICIAL_SATELLITE]   = {"Ast",  0xff00ffff},
-    [SYMBOL_OPEN_GALACTIC_CLUSTER]  = {"OpC" , 0xF2E9267F, opc_paint},
-    [SYMBOL_GLOBULAR_CLUSTER]       = {"GlC" , 0xF2E9267F, glc_paint},
-    [SYMBOL_GALAXY]                 = {"G"   , 0xFF930E7F,   g_paint},
-    [SYMBOL_INTERACTING_GALAXIES]   = {"IG"  , 0xFF930E7F,   g_paint},
-    [SYMBOL_PLANETARY_NEBULA]       = {"PN"  , 0xF2E9267F,  pn_paint},
-    [SYMBOL_INTERSTELLAR_MATTER]    = {"ISM" , 0xF2E9267F, ism_paint},
-    [SYMBOL_UNKNOWN]                = {"?"   , 0xF2E9267F, ism_paint},
-    [SYMBOL_BRIGHT_NEBULA]          = {"BNe" , 0x89ff5f7f, bne_paint},
-    [SYMBOL_CLUSTER_OF_STARS]       = {"Cl*" , 0x89ff5f7f, cls_paint},
-    [SYMBOL_MULTIPLE_DEFAULT]       = {"mul" , 0x89ff5f7f, opc_paint},
-    [SYMBOL_METEOR_SHOWER]          = {"MSh" , 0x89ff5f7f, msh_paint},
+    [SYMBOL_OPEN_GALACTIC_CLUSTER]  = {"OpC" , 0xF2E9267F, OPC_PRIMS},
+    [SYMBOL_GLOBULAR_CLUSTER]       = {"GlC" , 0xF2E9267F, GLC_PRIMS},
+    [SYMBOL_GALAXY]                 = {"G"   , 0xFF930E7F, G_PRIMS},
+    [SYMBOL_INTERACTING_GALAXIES]   = {"IG"  , 0xFF930E7F, G_PRIMS},
+    [SYMBOL_PLANETARY_NEBULA]       = {"PN"  , 0xF2E9267F, PN_PRIMS},
+    [SYMBOL_INTERSTELLAR_MATTER]    = {"ISM" , 0xF2E9267F, G_PRIMS},
+    [SYMBOL_UNKNOWN]                = {"?"   , 0xF2E9267F, G_PRIMS},
+    [SYMBOL_BRIGHT_NEBULA]          = {"BNe" , 0x89ff5f7f, BNE_PRIMS},
+    [SYMBOL_CLUSTER_OF_STARS]       = {"Cl*" , 0x89ff5f7f, CLS_PRIMS},
+    [SYMBOL_MULTIPLE_DEFAULT]       = {"mul" , 0x89ff5f7f, OPC_PRIMS},
+    [SYMBOL_METEOR_SHOWER]          = {"MSh" , 0x89ff5f7f, MSH_PRIMS},
 };
 
+// Unit circle used to tesselate the solid ellipses.
+#define CIRCLE_SEGS 64
+static double g_circle[CIRCLE_SEGS + 1][2];
+
+// Growable buffer of window space segments.
+typedef struct {
+    int     nb;
+    int     allocated;
+    double  (*lines)[2][2];
+    double  width;  // Painter line width.
+} lines_buf_t;
+
 static void hex_to_rgba(uint32_t v, double rgba[4])
 {
     rgba[0] = ((v >> 24) & 0xff) / 255.0f,
@@ -82,105 +145,189 @@ int symbols_get_for_otype(const char *type)
     return 0;
 }
 
-static void opc_paint(const painter_t *painter, const double transf[3][3])
+static void init_prims(void)
 {
-    double dashes = M_PI * 12 / 8;
-    paint_2d_ellipse(painter, transf, dashes, NULL, NULL, NULL);
-}
+    static bool done = false;
+    int i, nb = 7;
+    double a, r1, r2;
+    unsigned short xsubi[3] = {0, 0, 3};
 
-static void cls_paint(const painter_t *painter, const double transf_[3][3])
-{
-    double transf[3][3];
-    double dashes = M_PI * 12 * 0.8 / 8;
-    mat3_copy(transf_, transf);
-    paint_2d_rect(painter, transf, NULL, NULL);
-    mat3_iscale(transf, 0.8, 0.8, 1);
-    paint_2d_ellipse(painter, transf, dashes, NULL, NULL, NULL);
+    if (done) return;
+    done = true;
+    for (i = 0; i <= CIRCLE_SEGS; i++) {
+        a = i * 2 * M_PI / CIRCLE_SEGS;
+        g_circle[i][0] = cos(a);
+        g_circle[i][1] = sin(a);
+    }
+
+    // Meteor shower symbol: randomized rays around the center.
+    for (i = 0; i < nb; i++) {
+        a = i * 2 * M_PI / nb;
+        a += (erand48(xsubi) - 0.5) * 15 * DD2R;
+        r1 = mix(0.25, 0.3, erand48(xsubi));
+        r2 = mix(0.75, 1.0, erand48(xsubi));
+        MSH_PRIMS[i].type = PRIM_LINE;
+        MSH_PRIMS[i].p1[0] = r1 * cos(a);
+        MSH_PRIMS[i].p1[1] = r1 * sin(a);
+        MSH_PRIMS[i].p2[0] = r2 * cos(a);
+        MSH_PRIMS[i].p2[1] = r2 * sin(a);
+    }
 }
 
-static void g_paint(const painter_t *painter, const double transf[3][3])
+static void push_line(lines_buf_t *buf, const double p1[2], const double p2[2])
 {
-    // double transf[3][3];
-    // mat4_copy(transf_, transf);
-    // mat4_iscale(transf, 0.5, 1, 1);
-    paint_2d_ellipse(painter, transf, 0, NULL, NULL, NULL);
+    if (buf->nb >= buf->allocated) {
+        buf->allocated = buf->allocated ? buf->allocated * 2 : 256;
+        buf->lines = realloc(buf->lines,
+                             buf->allocated * sizeof(*buf->lines));
+    }
+    vec2_copy(p1, buf->lines[buf->nb][0]);
+    vec2_copy(p2, buf->lines[buf->nb][1]);
+    buf->nb++;
 }
 
-static void pn_paint(const painter_t *painter, const double transf[3][3])
+// Add a line given in the symbol unit space.
+static void add_line(lines_buf_t *buf, const double m[3][3],
+                     const double p1[2], const double p2[2])
 {
-    paint_2d_line(painter, transf, VEC(-1.75, 0), VEC(-1, 0));
-    paint_2d_line(painter, transf, VEC(+1, 0), VEC(+1.75, 0));
-    paint_2d_line(painter, transf, VEC(0, -1), VEC(0, -1.75));
-    paint_2d_line(painter, transf, VEC(0, +1), VEC(0, +1.75));
-    paint_2d_ellipse(painter, transf, 0, NULL, NULL, NULL);
+    double a[3] = {p1[0], p1[1], 1}, b[3] = {p2[0], p2[1], 1};
+    mat3_mul_vec3(m, a, a);
+    mat3_mul_vec3(m, b, b);
+    push_line(buf, a, b);
 }
 
-static void ism_paint(const painter_t *painter, const double transf[3][3])
+static void add_ellipse(lines_buf_t *buf, const double transf[3][3],
+                        const prim_t *prim)
 {
-    paint_2d_ellipse(painter, transf, 0, NULL, NULL, NULL);
+    int i, step;
+    double m[3][3], perimeter, nb_dashes, a, da, p1[2], p2[2];
+
+    mat3_copy(transf, m);
+    mat3_iscale(m, prim->scale, prim->scale, 1);
+    perimeter = 2 * M_PI * sqrt((vec2_norm2(m[0]) + vec2_norm2(m[1])) / 2);
+    if (perimeter <= 0) return;
+
+    // Dashes have a constant length in pixel, like the previous nanovg
+    // rendering, so we can't cache them in the unit space.
+    if (prim->dashes) {
+        nb_dashes = perimeter / prim->dashes;
+        da = 2 * M_PI / nb_dashes;
+        for (a = 0; a < 2 * M_PI; a += da) {
+            vec2_set(p1, cos(a), sin(a));
+            vec2_set(p2, cos(a + da / 2), sin(a + da / 2));
+            add_line(buf, m, p1, p2);
+        }
+        return;
+    }
+
+    // Small ellipses don't need the full resolution.
+    step = perimeter < 64 ? 2 : 1;
+    for (i = 0; i < CIRCLE_SEGS; i += step)
+        add_line(buf, m, g_circle[i], g_circle[i + step]);
 }
 
-static void bne_paint(const painter_t *painter, const double transf[3][3])
+static void add_rect(lines_buf_t *buf, const double transf[3][3],
+                     const prim_t *prim)
 {
-    paint_2d_rect(painter, transf, NULL, NULL);
+    int i;
+    double corners[4][3], d[2], p[2];
+    const double UNIT[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+
+    for (i = 0; i < 4; i++) {
+        vec3_set(corners[i], UNIT[i][0] * prim->scale,
+                             UNIT[i][1] * prim->scale, 1);
+        mat3_mul_vec3(transf, corners[i], corners[i]);
+    }
+    // The segments have butt caps, so we extend the start of each side
+    // to fill the corners without overlapping.
+    for (i = 0; i < 4; i++) {
+        vec2_sub(corners[(i + 1) % 4], corners[i], d);
+        if (vec2_norm2(d) == 0) return;
+        vec2_normalize(d, d);
+        vec2_addk(corners[i], d, -buf->width / 2, p);
+        push_line(buf, p, corners[(i + 1) % 4]);
+    }
 }
 
-static void glc_paint(const painter_t *painter, const double transf[3][3])
+static int png_paint(const painter_t *painter, const symbol_t *s)
 {
-    paint_2d_ellipse(painter, transf, 0, NULL, NULL, NULL);
-    paint_2d_line(painter, transf, VEC(-1, 0), VEC(1, 0));
-    paint_2d_line(painter, transf, VEC(0, -1), VEC(0, 1));
+    int i;
+    double uv[4][2];
+
+    for (i = 0; i < 4; i++) {
+        uv[i][0] = (((s->symbol - 1) % 4) + ((3 - i) % 2)) / 4.0;
+        uv[i][1] = (((s->symbol - 1) / 4) + (i / 2)) / 4.0;
+    }
+    return paint_texture(painter, get_texture(), uv, s->pos, s->size[0],
+                         s->color, s->angle);
 }
 
-static void msh_paint(const painter_t *painter, const double transf[3][3])
+int symbols_paint_n(const painter_t *painter_, int n,
+                    const symbol_t *symbols)
 {
-    int i, nb = 7;
-    double a, p1[2], p2[2], r1, r2;
-    unsigned short xsubi[3] = {0, 0, 3};
-    for (i = 0; i < nb; i++) {
-        a = i * 2 * M_PI / nb;
-        a += (erand48(xsubi) - 0.5) * 15 * DD2R;
-        r1 = mix(0.25, 0.3, erand48(xsubi));
-        r2 = mix(0.75, 1.0, erand48(xsubi));
-        p1[0] = r1 * cos(a);
-        p1[1] = r1 * sin(a);
-        p2[0] = r2 * cos(a);
-        p2[1] = r2 * sin(a);
-        paint_2d_line(painter, transf, p1, p2);
+    int i;
+    double transf[3][3];
+    const symbol_t *s;
+    const prim_t *prim;
+    painter_t painter = *painter_;
+    lines_buf_t buf = {.width = painter.lines.width};
+
+    init_prims();
+    for (i = 0; i < n; i++) {
+        s = &symbols[i];
+        assert(s->symbol >= 0 && s->symbol < ARRAY_SIZE(ENTRIES));
+        if (!s->symbol) continue;
+        if (!ENTRIES[s->symbol].prims) {
+            png_paint(&painter, s);
+            continue;
+        }
+        mat3_set_identity(transf);
+        mat3_itranslate(transf, s->pos[0], s->pos[1]);
+        mat3_rz(s->angle, transf, transf);
+        mat3_iscale(transf, s->size[0] / 2, s->size[1] / 2, 1);
+
+        buf.nb = 0;
+        for (prim = ENTRIES[s->symbol].prims; prim->type; prim++) {
+            switch (prim->type) {
+            case PRIM_ELLIPSE:
+                add_ellipse(&buf, transf, prim);
+                break;
+            case PRIM_RECT:
+                add_rect(&buf, transf, prim);
+                break;
+            case PRIM_LINE:
+                add_line(&buf, transf, prim->p1, prim->p2);
+                break;
+            }
+        }
+        // All the segments end up in the same render item, whatever the
+        // symbol or color.
+        vec4_copy(s->color, painter.color);
+        paint_2d_lines(&painter, buf.nb, (const double (*)[2][2])buf.lines);
     }
+    free(buf.lines);
+    return 0;
 }
 
+void symbols_get_default_color(int symbol, double color[4])
+{
+    assert(symbol > 0 && symbol < ARRAY_SIZE(ENTRIES));
+    hex_to_rgba(ENTRIES[symbol].color, color);
+}
 
-int symbols_paint(const painter_t *painter_, int symbol,
+int symbols_paint(const painter_t *painter, int symbol,
                   const double pos[2], const double size[2],
                   const double color[4],
                   double angle)
 {
-    int i;
-    double uv[4][2], c[4], transf[3][3];
-    painter_t painter = *painter_;
+    symbol_t s = {.symbol = symbol, .angle = angle};
     assert(symbol >= 0);
     if (!symbol) return 0;
-    if (!color) {
-        hex_to_rgba(ENTRIES[symbol].color, c);
-        color = c;
-    }
-    // Procedural symbol.
-    if (ENTRIES[symbol].paint) {
-        vec4_copy(color, painter.color);
-        mat3_set_identity(transf);
-        mat3_itranslate(transf, pos[0], pos[1]);
-        mat3_rz(angle, transf, transf);
-        mat3_iscale(transf, size[0] / 2, size[1] / 2, 1);
-        ENTRIES[symbol].paint(&painter, transf);
-        return 0;
-    }
-
-    // Png symbol.
-    for (i = 0; i < 4; i++) {
-        uv[i][0] = (((symbol - 1) % 4) + ((3 - i) % 2)) / 4.0;
-        uv[i][1] = (((symbol - 1) / 4) + (i / 2)) / 4.0;
-    }
-    return paint_texture(&painter, get_texture(), uv, pos, size[0],
-                         color, angle);
+    vec2_copy(pos, s.pos);
+    vec2_copy(size, s.size);
+    if (color)
+        vec4_copy(color, s.color);
+    else
+        symbols_get_default_color(symbol, s.color);
+    return symbols_paint_n(painter, 1, &s);
 }
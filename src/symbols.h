@@ -37,6 +37,18 @@ enum {
     SYMBOL_METEOR_SHOWER,
 };
 
+/*
+ * Type: symbol_t
+ * A symbol instance, as passed to <symbols_paint_n>.
+ */
+typedef struct symbol {
+    int     symbol;     // One of the <SYMBOL_ENUM> value.
+    double  pos[2];     // Position in window coordinates.
+    double  size[2];    // Size in window coordinates.
+    double  angle;      // Angle, clockwise (rad).
+    double  color[4];   // Color to use.
+} symbol_t;
+
 void symbols_init(void);
 
 /*
@@ -68,4 +80,26 @@ int symbols_paint(const painter_t *painter, int symbol,
                   const double pos[2], const double size[2],
                   const double color[4], double angle);
 
+/*
+ * Function: symbols_paint_n
+ * Render a batch of symbols
+ *
+ * The procedural symbols are all tesselated into the same render item, so
+ * this is much faster than calling <symbols_paint> for each symbol.  All
+ * the symbols use the painter line width.
+ *
+ * Parameters:
+ *   painter    - A painter.
+ *   n          - Number of symbols.
+ *   symbols    - The symbols to render.
+ */
+int symbols_paint_n(const painter_t *painter, int n,
+                    const symbol_t *symbols);
+
+/*
+ * Function: symbols_get_default_color
+ * Get the default color defined for a symbol.
+ */
+void symbols_get_default_color(int symbol, double color[4]);
+
 #endif // SYMBOLS_H
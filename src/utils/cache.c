@@ -106,6 +106,20 @@ void cache_set_cost(cache_t *cache, const void *key, int keylen, int cost)
     if (cache->size >= cache->max_size) cleanup(cache);
 }
 
+void cache_evict(cache_t *cache, int (*filter)(void *data, void *user),
+                 void *user)
+{
+    item_t *item, *tmp;
+    HASH_ITER(hh, cache->items, item, tmp) {
+        if (!filter(item->data, user)) continue;
+        if (item->delfunc && item->delfunc(item->data) == CACHE_KEEP)
+            continue;
+        HASH_DEL(cache->items, item);
+        cache->size -= item->cost;
+        free(item);
+    }
+}
+
 /*
  * Function: cache_get_current_size
  * Return the total cost of all the currently cached items
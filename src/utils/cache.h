@@ -76,6 +76,21 @@ void *cache_get(cache_t *cache, const void *key, int keylen);
  */
 void cache_set_cost(cache_t *cache, const void *key, int keylen, int cost);
 
+/*
+ * Function: cache_evict
+ * Remove all the items matching a filter function from the cache.
+ *
+ * The items whose delete function returns CACHE_KEEP stay in the cache.
+ *
+ * Parameters:
+ *   cache  - A cache.
+ *   filter - Function called on each item data, should return non zero
+ *            for the items to remove.
+ *   user   - Pointer passed to the filter function.
+ */
+void cache_evict(cache_t *cache, int (*filter)(void *data, void *user),
+                 void *user);
+
 /*
  * Function: cache_get_current_size
  * Return the total cost of all the currently cached items
@@ -40,6 +40,7 @@ mesh_t *mesh_create(void)
 void mesh_delete(mesh_t *mesh)
 {
     free(mesh->vertices);
+    free(mesh->colors);
     free(mesh->triangles);
     free(mesh->lines);
     free(mesh->points);
@@ -56,6 +57,11 @@ mesh_t *mesh_copy(const mesh_t *mesh)
     ret->vertices = malloc(ret->vertices_count * sizeof(*ret->vertices));
     memcpy(ret->vertices, mesh->vertices,
            ret->vertices_count * sizeof(*ret->vertices));
+    if (mesh->colors) {
+        ret->colors = malloc(ret->vertices_count * sizeof(*ret->colors));
+        memcpy(ret->colors, mesh->colors,
+               ret->vertices_count * sizeof(*ret->colors));
+    }
     ret->triangles = malloc(ret->triangles_count * sizeof(*ret->triangles));
     memcpy(ret->triangles, mesh->triangles,
            ret->triangles_count * sizeof(*ret->triangles));
@@ -110,10 +116,27 @@ int mesh_add_vertices(mesh_t *mesh, int count, const double (*verts)[3])
             (mesh->vertices_count + count) * sizeof(*mesh->vertices));
     memcpy(mesh->vertices + mesh->vertices_count, verts,
            count * sizeof(*mesh->vertices));
+    if (mesh->colors) {
+        mesh->colors = realloc(mesh->colors,
+                (mesh->vertices_count + count) * sizeof(*mesh->colors));
+        memset(mesh->colors + mesh->vertices_count, 255,
+               count * sizeof(*mesh->colors));
+    }
     mesh->vertices_count += count;
     return ofs;
 }
 
+// Set the color of a new vertex by interpolating two vertices colors.
+static void mesh_mix_colors(mesh_t *mesh, int a, int b, double k, int dst)
+{
+    int i;
+    if (!mesh->colors) return;
+    for (i = 0; i < 4; i++) {
+        mesh->colors[dst][i] = round(mesh->colors[a][i] * (1 - k) +
+                                     mesh->colors[b][i] * k);
+    }
+}
+
 void mesh_add_line_lonlat(mesh_t *mesh, int size, const double (*verts)[2],
                           bool loop)
 {
@@ -286,7 +309,7 @@ static void mesh_cut_triangle_antimeridian(mesh_t *mesh, int idx)
 {
     int i, a, b, c, ofs, ab1, ab2, ac1, ac2;
     const double (*vs)[3] = mesh->vertices;
-    double ab[3], ac[3], new_points[4][3];
+    double ab[3], ac[3], new_points[4][3], kab, kac;
     for (i = 0; i < 3; i++) {
         a = mesh->triangles[idx + i];
         b = mesh->triangles[idx + (i + 1) % 3];
@@ -302,12 +325,19 @@ static void mesh_cut_triangle_antimeridian(mesh_t *mesh, int idx)
     vec3_mix(vs[b], ab, 0.99, new_points[1]); // AB2
     vec3_mix(vs[a], ac, 0.99, new_points[2]); // AC1
     vec3_mix(vs[c], ac, 0.99, new_points[3]); // AC2
+    // Position of the cuts along the sides, to interpolate the colors.
+    kab = vs[a][0] / (vs[a][0] - vs[b][0]);
+    kac = vs[a][0] / (vs[a][0] - vs[c][0]);
 
     ofs = mesh_add_vertices(mesh, 4, new_points);
     ab1 = ofs + 0;
     ab2 = ofs + 1;
     ac1 = ofs + 2;
     ac2 = ofs + 3;
+    mesh_mix_colors(mesh, a, b, kab, ab1);
+    mesh_mix_colors(mesh, a, b, kab, ab2);
+    mesh_mix_colors(mesh, a, c, kac, ac1);
+    mesh_mix_colors(mesh, a, c, kac, ac2);
 
     // A,B,C -> A, AB1, AC1
     mesh->triangles[idx + (i + 1) % 3] = ab1;
@@ -319,7 +349,7 @@ static void mesh_cut_triangle_antimeridian(mesh_t *mesh, int idx)
 static void mesh_cut_segment_antimeridian(mesh_t *mesh, int idx)
 {
     const double (*vs)[3] = mesh->vertices;
-    double ab[3], new_points[2][3];
+    double ab[3], new_points[2][3], k;
     int a, b, ofs;
     a = mesh->lines[idx];
     b = mesh->lines[idx + 1];
@@ -328,7 +358,10 @@ static void mesh_cut_segment_antimeridian(mesh_t *mesh, int idx)
     // We add a small gap around the cut, to avoid rendering problems.
     vec3_mix(vs[a], ab, 0.99, new_points[0]);
     vec3_mix(vs[b], ab, 0.99, new_points[1]);
+    k = vs[a][0] / (vs[a][0] - vs[b][0]);
     ofs = mesh_add_vertices(mesh, 2, new_points);
+    mesh_mix_colors(mesh, a, b, k, ofs);
+    mesh_mix_colors(mesh, a, b, k, ofs + 1);
     mesh->lines[idx + 1] = ofs;
     mesh_add_segment(mesh, ofs + 1, b);
 }
@@ -362,6 +395,7 @@ static void mesh_subdivide_edge(mesh_t *mesh, int e1, int e2)
     vec3_mix(vs[e1], vs[e2], 0.5, new_point);
     // vec3_normalize(new_point, new_point);
     o = mesh_add_vertices(mesh, 1, &new_point);
+    mesh_mix_colors(mesh, e1, e2, 0.5, o);
 
     count = mesh->triangles_count;
     for (i = 0; i < count; i += 3) {
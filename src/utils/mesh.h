@@ -23,6 +23,10 @@ struct mesh {
     double      bounding_cap[4]; // Not automatically updated.
     int         vertices_count;
     double      (*vertices)[3];
+    // Optional per vertex RGBA colors, modulated by the painter color.
+    // New vertices added by the subdivision functions get interpolated
+    // colors.
+    uint8_t     (*colors)[4];
 
     int         triangles_count; // Number of triangles * 3.
     uint16_t    *triangles;
@@ -88,6 +88,27 @@ uint8_t *img_read_from_mem(const void *data, int size,
     return stbi_load_from_memory(data, size, w, h, bpp, *bpp);
 }
 
+uint8_t *img_read_from_mem_scaled(const void *data, int size, int *shift,
+                                  int *w, int *h, int *bpp)
+{
+    WebPDecoderConfig config;
+
+    if (*shift <= 0 || !WebPGetInfo(data, size, w, h)) {
+        *shift = 0;
+        return img_read_from_mem(data, size, w, h, bpp);
+    }
+    if (!WebPInitDecoderConfig(&config)) return NULL;
+    config.options.use_scaling = 1;
+    config.options.scaled_width = *w >> *shift ?: 1;
+    config.options.scaled_height = *h >> *shift ?: 1;
+    config.output.colorspace = MODE_RGBA;
+    if (WebPDecode(data, size, &config) != VP8_STATUS_OK) return NULL;
+    *w = config.options.scaled_width;
+    *h = config.options.scaled_height;
+    *bpp = 4;
+    return config.output.u.RGBA.rgba;
+}
+
 void img_write(const uint8_t *img, int w, int h, int bpp, const char *path)
 {
     stbi_write_png(path, w, h, bpp, img, 0);
@@ -151,6 +172,61 @@ error:
     return NULL;
 }
 
+int z_uncompress_gz_lines(const void *src, int src_size, void *user,
+                          int (*f)(void *user, const char *line, int len))
+{
+    const int chunk_size = 1 << 16;
+    int err, size = 0, buf_size = chunk_size;
+    char *buf, *line, *end;
+    z_stream stream = {};
+
+    buf = malloc(buf_size + 1);
+    stream.next_in = (void*)src;
+    stream.avail_in = src_size;
+    // 16 + 15: let zlib parse the gz header and footer.
+    err = inflateInit2(&stream, 16 + 15);
+    if (err != Z_OK) goto error;
+
+    while (true) {
+        // Grow the buffer if a single line doesn't fit into it.
+        if (size == buf_size) {
+            buf_size *= 2;
+            buf = realloc(buf, buf_size + 1);
+        }
+        stream.next_out = (void*)(buf + size);
+        stream.avail_out = buf_size - size;
+        err = inflate(&stream, Z_NO_FLUSH);
+        if (err != Z_OK && err != Z_STREAM_END) goto error;
+        size = buf_size - stream.avail_out;
+
+        for (line = buf; (end = memchr(line, '\n', size - (line - buf)));
+             line = end + 1) {
+            *end = '\0';
+            if (end > line && f(user, line, end - line)) goto end;
+        }
+        if (err == Z_STREAM_END) {
+            buf[size] = '\0';
+            if (line < buf + size) f(user, line, buf + size - line);
+            break;
+        }
+        // Move the last incomplete line at the start of the buffer.
+        size -= line - buf;
+        memmove(buf, line, size);
+    }
+
+end:
+    inflateEnd(&stream);
+    free(buf);
+    return 0;
+
+error:
+    LOG_E("Cannot uncompress gz file!");
+    if (stream.msg) LOG_E("%s", stream.msg);
+    inflateEnd(&stream);
+    free(buf);
+    return -1;
+}
+
 bool str_endswith(const char *str, const char *end)
 {
     if (!str || !end) return false;
@@ -9,18 +9,30 @@
 
 #include "texture.h"
 #include "gl.h"
+#include "system.h"
 
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Max number of bytes of scheduled textures uploaded per frame.
+#define UPLOAD_BUDGET (4 * (1 << 20))
+
 static struct {
     void *user;
     uint8_t *(*load)(void *user, const char *url, int *code,
                      int *w, int *h, int *bpp);
 } g_callback = {};
 
+// Scheduled uploads budget and stats for the current frame.
+static struct {
+    int     budget;         // Remaining bytes we can upload.
+    int     nb_uploaded;
+    int     nb_deferred;
+    double  time;           // Time spent in texture uploads (sec).
+} g_upload = {.budget = UPLOAD_BUDGET};
+
 static inline bool is_pow2(int n) {return (n & (n - 1)) == 0;}
 static inline int next_pow2(int x) {return pow(2, ceil(log(x) / log(2)));}
 
@@ -50,6 +62,7 @@ void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
 {
     uint8_t *buff0 = NULL;
     int data_type = GL_UNSIGNED_BYTE;
+    double start_time = sys_get_unix_time();
     assert(tex->id);
 
     tex->w = w;
@@ -79,6 +92,36 @@ void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp)
 
     if (tex->flags & TF_MIPMAP)
         GL(glGenerateMipmap(GL_TEXTURE_2D));
+    g_upload.time += sys_get_unix_time() - start_time;
+}
+
+void texture_upload_begin_frame(void)
+{
+    g_upload.budget = UPLOAD_BUDGET;
+    g_upload.nb_uploaded = 0;
+    g_upload.nb_deferred = 0;
+    g_upload.time = 0;
+}
+
+bool texture_upload_request(int size)
+{
+    // Always accept the first upload, so that we still make progress with
+    // textures larger than the budget.
+    if (size > g_upload.budget && g_upload.nb_uploaded) {
+        g_upload.nb_deferred++;
+        return false;
+    }
+    g_upload.budget -= size;
+    g_upload.nb_uploaded++;
+    return true;
+}
+
+void texture_upload_get_stats(int *nb_uploaded, int *nb_deferred,
+                              double *time)
+{
+    if (nb_uploaded) *nb_uploaded = g_upload.nb_uploaded;
+    if (nb_deferred) *nb_deferred = g_upload.nb_deferred;
+    if (time) *time = g_upload.time;
 }
 
 texture_t *texture_create(int w, int h, int bpp)
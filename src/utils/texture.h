@@ -70,3 +70,39 @@ texture_t *texture_from_url(const char *url, int flags);
 bool texture_load(texture_t *tex, int *code);
 void texture_set_data(texture_t *tex, const void *data, int w, int h, int bpp);
 void texture_release(texture_t *tex);
+
+/*
+ * Function: texture_upload_begin_frame
+ * Reset the scheduled uploads budget and stats for a new frame.
+ */
+void texture_upload_begin_frame(void);
+
+/*
+ * Function: texture_upload_request
+ * Check if we can upload a texture of a given size during this frame.
+ *
+ * This is used for the textures we can create later (like the hips tiles)
+ * so that we don't stall a single frame with dozens of uploads.  The
+ * caller should try again at the next frame if this returns false.
+ *
+ * Parameters:
+ *   size   - Size of the texture data in bytes.
+ *
+ * Return:
+ *   True if the caller can upload the texture now.
+ */
+bool texture_upload_request(int size);
+
+/*
+ * Function: texture_upload_get_stats
+ * Get the textures uploads stats for the current frame.
+ *
+ * All the parameters can be set to NULL.
+ *
+ * Parameters:
+ *   nb_uploaded    - Number of accepted scheduled uploads.
+ *   nb_deferred    - Number of scheduled uploads postponed to a later frame.
+ *   time           - Total time spent uploading textures data (sec).
+ */
+void texture_upload_get_stats(int *nb_uploaded, int *nb_deferred,
+                              double *time);
@@ -8,8 +8,10 @@
  */
 
 #include "utf8.h"
-#include <string.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 static const char LEN_TABLE[256] = {
     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
@@ -44,23 +46,61 @@ int u8_char_len(const char *c)
     return LEN_TABLE[(unsigned int)(unsigned char)c[0]] + 1;
 }
 
-void u8_lower(char *dst, const char *str, int size)
+/*
+ * Case mapping tables of the two bytes characters, indexed by code point.
+ * Generated from the ACCENTS list the first time we need them.
+ */
+static struct {
+    bool        init;
+    uint16_t    upper[0x800];
+    uint16_t    lower[0x800];
+    char        base[0x800];    // Non accentuated letter, or zero.
+} g_tables;
+
+static void init_tables(void)
 {
-    const char* ptr;
-    int len;
+    const char *ptr;
+    int i, u, l;
+
+    if (g_tables.init) return;
+    for (i = 0; i < 0x800; i++) {
+        g_tables.upper[i] = i;
+        g_tables.lower[i] = i;
+    }
+    for (ptr = ACCENTS; *ptr; ptr += 8) {
+        u = u8_char_code(ptr);
+        l = u8_char_code(ptr + 2);
+        g_tables.upper[l] = u;
+        g_tables.lower[u] = l;
+        g_tables.base[u] = ptr[4];
+        g_tables.base[l] = ptr[5];
+    }
+    g_tables.init = true;
+}
+
+static void case_map(char *dst, const char *str, int size,
+                     const uint16_t table[0x800], char from, char to)
+{
+    unsigned char c;
+    int len, code;
+
+    init_tables();
     while (*str) {
+        c = *str;
+        // Fast path for ascii characters.
+        if (c < 0x80) {
+            if (size < 2) break;
+            *dst++ = (c >= from && c < from + 26) ? c - from + to : c;
+            str++;
+            size--;
+            continue;
+        }
         len = u8_char_len(str);
         if (len + 1 > size) break;
-        if (len == 1 && *str >= 'A' && *str <= 'Z') {
-            *dst = *str - 'A' + 'a';
-        } else if (len == 2) {
-            memcpy(dst, str, 2);
-            for (ptr = ACCENTS; *ptr; ptr += 8) {
-                if (memcmp(ptr, str, 2) == 0) {
-                    memcpy(dst, ptr + 2, 2);
-                    break;
-                }
-            }
+        if (len == 2) {
+            code = table[u8_char_code(str)];
+            dst[0] = 0xC0 | (code >> 6);
+            dst[1] = 0x80 | (code & 0x3F);
         } else {
             memcpy(dst, str, len);
         }
@@ -71,31 +111,14 @@ void u8_lower(char *dst, const char *str, int size)
     *dst = '\0';
 }
 
+void u8_lower(char *dst, const char *str, int size)
+{
+    case_map(dst, str, size, g_tables.lower, 'A', 'a');
+}
+
 void u8_upper(char *dst, const char *str, int size)
 {
-    const char* ptr;
-    int len;
-    while (*str) { //  && n > 2) {
-        len = u8_char_len(str);
-        if (len + 1 > size) break;
-        if (len == 1 && *str >= 'a' && *str <= 'z') {
-            *dst = *str - 'a' + 'A';
-        } else if (len == 2) {
-            memcpy(dst, str, 2);
-            for (ptr = ACCENTS; *ptr; ptr += 8) {
-                if (memcmp(ptr + 2, str, 2) == 0) {
-                    memcpy(dst, ptr, 2);
-                    break;
-                }
-            }
-        } else {
-            memcpy(dst, str, len);
-        }
-        str += len;
-        dst += len;
-        size -= len;
-    }
-    *dst = '\0';
+    case_map(dst, str, size, g_tables.upper, 'a', 'A');
 }
 
 int u8_len(const char *str)
@@ -132,24 +155,15 @@ int u8_char_code(const char *c)
 void u8_remove_accents(char *dst, const char *str, int n)
 {
     int len;
-    const char *ptr;
+    char base;
+    init_tables();
     while (*str && n > 0) {
         len = u8_char_len(str);
         memcpy(dst, str, len);
         str += len;
-        if (len == 2) {
-            for (ptr = ACCENTS; *ptr; ptr += 8) {
-                if (memcmp(ptr + 0, dst, 2) == 0) {
-                    len = 1;
-                    *dst = *(ptr + 4);
-                    break;
-                }
-                if (memcmp(ptr + 2, dst, 2) == 0) {
-                    len = 1;
-                    *dst = *(ptr + 5);
-                    break;
-                }
-            }
+        if (len == 2 && (base = g_tables.base[u8_char_code(dst)])) {
+            len = 1;
+            *dst = base;
         }
         dst += len;
         n -= len;
@@ -99,6 +99,21 @@ uint8_t *img_read(const char *path, int *w, int *h, int *bpp);
 uint8_t *img_read_from_mem(const void *data, int size,
                            int *w, int *h, int *bpp);
 
+/*
+ * Function: img_read_from_mem_scaled
+ * Read a png/jpeg/webp image from memory, reducing its size if possible.
+ *
+ * Only WebP images can be decoded directly at a reduced size.  The other
+ * formats are always decoded at full size, since downsampling them after
+ * the decoding would not save any work.
+ *
+ * Parameters:
+ *   shift  - Input: the requested size reduction, the image size being
+ *            divided by 2^shift.  Output: the reduction actually applied.
+ */
+uint8_t *img_read_from_mem_scaled(const void *data, int size, int *shift,
+                                  int *w, int *h, int *bpp);
+
 /*
  * Function: img_write
  * Write an image to file.
@@ -117,6 +132,28 @@ int z_uncompress(void *dest, int dest_size, const void *src, int src_size);
  */
 void *z_uncompress_gz(const void *src, int src_size, int *out_size);
 
+/*
+ * Function: z_uncompress_gz_lines
+ * Iter all the lines of gz compressed text data.
+ *
+ * The data is uncompressed by small chunks, so that we never need to keep
+ * the full uncompressed text in memory.  Empty lines are skipped.
+ *
+ * Parameters:
+ *   src        - The gz data.
+ *   src_size   - Size of the gz data.
+ *   user       - User data passed to the callback.
+ *   f          - Callback called for each line.  The line is null
+ *                terminated (without the newline character), and only
+ *                valid during the call.  If the callback returns a non
+ *                zero value we stop the iteration.
+ *
+ * Return:
+ *   Zero on success, or -1 in case of error.
+ */
+int z_uncompress_gz_lines(const void *src, int src_size, void *user,
+                          int (*f)(void *user, const char *line, int len));
+
 /*
  * Function: str_startswith
  * Test is a string starts with an other one.